@@ -0,0 +1,248 @@
+#define BOOST_SYSTEM_NO_LIB
+#define BOOST_JSON_STANDALONE
+
+#include <benchmark/benchmark.h>
+
+#include <boost/json/src.hpp>
+#include <boost/json.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "api.hpp"
+#include "cache.hpp"
+#include "decoder.hpp"
+#include "http_client.hpp"
+#include "models.hpp"
+#include "response_cache.hpp"
+#include "route.hpp"
+#include "serialize.hpp"
+
+namespace json = boost::json;
+
+// Fills the character cache and the upstream count as a completed warm-up
+// would, so whole-list calls are answered from memory.
+struct ApiTestAccess {
+    static void prime_characters(RickAndMortyApi& api, const std::vector<CharacterPtr>& characters, int upstream_count) {
+        for (auto const& c : characters)
+            api.store_character(*c);
+        api.characters_upstream_count_ = upstream_count;
+    }
+};
+
+// Fixtures follow the upstream /api/character schema. Nothing here touches
+// the network: the API is primed directly from these pages.
+namespace {
+constexpr int kCharacters = 826;
+constexpr int kPageSize   = 20;
+constexpr int kPages      = (kCharacters + kPageSize - 1) / kPageSize;
+constexpr std::string_view kApi = "https://rickandmortyapi.com/api/";
+
+constexpr std::array<std::string_view, 3> kStatus{"Alive", "Dead", "unknown"};
+constexpr std::array<std::string_view, 4> kSpecies{"Human", "Alien", "Humanoid", "Robot"};
+constexpr std::array<std::string_view, 3> kGender{"Male", "Female", "unknown"};
+
+std::string url(std::string_view resource, int id) {
+    return std::string(kApi) + std::string(resource) + "/" + std::to_string(id);
+}
+
+json::value page_url(int page) {
+    if (page < 1 || page > kPages)
+        return nullptr;
+    return json::value(std::string_view(std::string(kApi) + "character/?page=" + std::to_string(page)));
+}
+
+json::object character_json(int id) {
+    json::array episodes;
+    for (int e = 1; e <= 1 + id % 30; ++e)
+        episodes.push_back(json::value(std::string_view(url("episode", e))));
+
+    json::object c;
+    c["id"]       = id;
+    c["name"]     = std::string_view("Character " + std::to_string(id));
+    c["status"]   = kStatus[id % kStatus.size()];
+    c["species"]  = kSpecies[id % kSpecies.size()];
+    c["type"]     = std::string_view(id % 5 == 0 ? "Parasite" : "");
+    c["gender"]   = kGender[id % kGender.size()];
+    c["origin"]   = {{"name", "Earth (C-137)"}, {"url", std::string_view(url("location", 1))}};
+    c["location"] = {{"name", "Citadel of Ricks"}, {"url", std::string_view(url("location", 3))}};
+    c["image"]    = std::string_view(std::string(kApi) + "character/avatar/" + std::to_string(id) + ".jpeg");
+    c["episode"]  = std::move(episodes);
+    c["url"]      = std::string_view(url("character", id));
+    c["created"]  = "2017-11-04T18:48:46.250Z";
+    return c;
+}
+
+std::string character_page(int page) {
+    json::array results;
+    for (int id = (page - 1) * kPageSize + 1; id <= std::min(kCharacters, page * kPageSize); ++id)
+        results.push_back(character_json(id));
+
+    json::object info;
+    info["count"] = kCharacters;
+    info["pages"] = kPages;
+    info["next"]  = page_url(page + 1);
+    info["prev"]  = page_url(page - 1);
+
+    json::object out;
+    out["info"]    = std::move(info);
+    out["results"] = std::move(results);
+    return json::serialize(out);
+}
+
+const std::string& first_page() {
+    static const std::string page = character_page(1);
+    return page;
+}
+
+const std::vector<CharacterPtr>& all_characters() {
+    static const std::vector<CharacterPtr> all = [] {
+        std::vector<CharacterPtr> out;
+        out.reserve(kCharacters);
+        for (int p = 1; p <= kPages; ++p) {
+            for (auto& c : decode_characters(character_page(p)).results) {
+                c.serialized = serialize_character(c);
+                out.push_back(std::make_shared<const Character>(std::move(c)));
+            }
+        }
+        return out;
+    }();
+    return all;
+}
+
+struct PrimedApi {
+    HttpClient client{false};
+    RickAndMortyApi api{client};
+
+    PrimedApi() { ApiTestAccess::prime_characters(api, all_characters(), kCharacters); }
+};
+
+RickAndMortyApi& primed_api() {
+    static PrimedApi primed;
+    return primed.api;
+}
+}
+
+// Baseline for the SAX decoder below: building the Boost.JSON tree alone.
+static void BM_ParseCharacterPageDom(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(json::parse(first_page()));
+    state.SetBytesProcessed(state.iterations() * first_page().size());
+}
+BENCHMARK(BM_ParseCharacterPageDom);
+
+static void BM_DecodeCharacterPage(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(decode_characters(first_page()));
+    state.SetBytesProcessed(state.iterations() * first_page().size());
+}
+BENCHMARK(BM_DecodeCharacterPage);
+
+static void BM_AllCharactersBasic(benchmark::State& state) {
+    auto& api = primed_api();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(api.get_all_characters_basic());
+    state.SetItemsProcessed(state.iterations() * kCharacters);
+}
+BENCHMARK(BM_AllCharactersBasic);
+
+static void BM_MatchRoute(benchmark::State& state) {
+    static constexpr std::array<std::pair<std::string_view, std::string_view>, 6> kTargets{{
+        {"/help",                      "index"},
+        {"/character/all",             "all"},
+        {"/character/42",              "single"},
+        {"/episode/1,2,3,4,5",         "batch"},
+        {"/character/?name=rick&status=alive", "query"},
+        {"/planet/1",                  "not_found"},
+    }};
+    auto [target, shape] = kTargets[state.range(0)];
+    for (auto _ : state)
+        benchmark::DoNotOptimize(match_route(target));
+    state.SetLabel(std::string(shape));
+}
+BENCHMARK(BM_MatchRoute)->DenseRange(0, 5);
+
+static void BM_SerializeCharacter(benchmark::State& state) {
+    auto const& c = *all_characters().front();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(serialize_character(c));
+}
+BENCHMARK(BM_SerializeCharacter);
+
+static void BM_SerializeCharacterList(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(serialize_character_list(all_characters()));
+    state.SetItemsProcessed(state.iterations() * kCharacters);
+}
+BENCHMARK(BM_SerializeCharacterList);
+
+static void BM_SerializeCharacterPage(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(serialize_character_page(all_characters(), 2, "status=alive"));
+}
+BENCHMARK(BM_SerializeCharacterPage);
+
+static void BM_ShardedCacheFind(benchmark::State& state) {
+    static ShardedCache<int, Character> cache;
+    if (state.thread_index() == 0 && cache.size() == 0) {
+        for (auto const& c : all_characters())
+            cache.insert(c->id, *c);
+    }
+
+    int id = 1 + state.thread_index();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cache.find(id));
+        id = id % kCharacters + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ShardedCacheFind)->Threads(1)->Threads(4)->Threads(16)->UseRealTime();
+
+static void BM_ResponseCacheGet(benchmark::State& state) {
+    static ResponseCache cache(64 * 1024 * 1024);
+    static const std::vector<std::string> keys = [] {
+        std::vector<std::string> out;
+        for (int id = 1; id <= kCharacters; ++id)
+            out.push_back("/api/character/" + std::to_string(id));
+        return out;
+    }();
+    if (state.thread_index() == 0 && cache.size() == 0) {
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            cache.put(keys[i], all_characters()[i]->serialized, std::chrono::hours(1));
+    }
+
+    std::size_t i = state.thread_index();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cache.get(keys[i]));
+        i = (i + 1) % keys.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ResponseCacheGet)->Threads(1)->Threads(4)->Threads(16)->UseRealTime();
+
+// Results are also written as JSON to bench_results.json unless the caller
+// passes its own --benchmark_out.
+int main(int argc, char** argv) {
+    std::vector<char*> args(argv, argv + argc);
+    std::string out = "--benchmark_out=bench_results.json";
+    std::string format = "--benchmark_out_format=json";
+    bool has_out = std::any_of(args.begin(), args.end(), [](const char* a) {
+        return std::string_view(a).starts_with("--benchmark_out=");
+    });
+    if (!has_out) {
+        args.push_back(out.data());
+        args.push_back(format.data());
+    }
+
+    int count = static_cast<int>(args.size());
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,35 +1,120 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
-#include <unordered_map>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/json.hpp>
 
+#include "cache.hpp"
+#include "decoder.hpp"
+#include "hedge.hpp"
 #include "http_client.hpp"
+#include "response_cache.hpp"
+#include "single_flight.hpp"
 #include "utils.hpp"
 #include "models.hpp"
+#include "query.hpp"
 
 class RickAndMortyApi {
 public:
-    explicit RickAndMortyApi(HttpClient& client);
-    std::string route_query(const std::string& target);
+    explicit RickAndMortyApi(HttpClient& client, std::size_t response_cache_bytes = 64 * 1024 * 1024);
+    ResponseCache::Body route_query(const std::string& target);
 
     std::vector<std::pair<int, std::string>> get_all_characters_basic();
-    std::vector<Character> get_characters_page(int page);
-    std::vector<Character> get_all_characters();
-    std::vector<Character> get_characters_by_ids(const std::vector<int>& ids);
-
-    std::string get_episode_all();
-    std::string get_episode_single(int id);
-    std::string get_episode_batch(const std::string& id_part);
-    std::string get_episode_query(const std::string& full_target);
+    std::shared_ptr<const std::string> get_all_characters_json();
+    // The cached /character/all body, or null if it must be rebuilt.
+    std::shared_ptr<const std::string> cached_all_characters_json() const;
+    // True once every upstream character is cached, so whole-list answers
+    // need no upstream call.
+    bool characters_complete() const;
+    std::vector<CharacterPtr> get_characters_page(int page);
+    // Pages [first, last] of /api/character fetched in parallel, in page order.
+    Page<CharacterPtr> get_characters_pages(int first, int last);
+    std::vector<CharacterPtr> get_all_characters();
+    std::vector<CharacterPtr> get_characters_by_ids(const std::vector<int>& ids);
+    std::vector<CharacterPtr> get_characters(const std::vector<int>& ids);
+
+    LocationPtr get_location(int id);
+    std::vector<LocationPtr> get_locations(const std::vector<int>& ids);
+    std::vector<LocationPtr> get_all_locations();
+    std::shared_ptr<const std::string> get_all_locations_json();
+
+    ResponseCache::Body get_episode_all();
+    ResponseCache::Body get_episode_single(int id);
+    ResponseCache::Body get_episode_batch(const std::string& id_part);
+    ResponseCache::Body get_episode_query(const std::string& full_target);
     
-    Episode get_episode(int id);
-    Character get_character(int id);
-    Character parse_character(const boost::json::object& obj);
+    EpisodePtr get_episode(int id);
+    CharacterPtr get_character(int id);
+
+    // Loads every character plus the episode and location lists into memory.
+    // Like refresh(), it fetches one page at a time without hedging.
+    void warm_up();
+    // Compares upstream info.count with what is cached and fetches only what
+    // is new. Returns the number of entities added.
+    std::size_t refresh();
+
+    bool save_snapshot(const std::string& path) const;
+    std::size_t load_snapshot(const std::string& path, std::chrono::seconds max_age);
+
+    // Races a second upstream GET against any that outlives the hedge delay.
+    // Attempts run on their own pool of `threads`, each on its own connection.
+    void enable_hedging(unsigned threads);
 
 private:
-    bool has_character_cached(int id) const;
+    // Lets tests and benchmarks prime the caches without an upstream; never
+    // defined in the server itself.
+    friend struct ApiTestAccess;
+
+    std::string fetch(const std::string& target);
+    std::string hedged_get(const std::string& target);
+    std::string timed_get(const std::string& target);
+    ResponseCache::Body fetch_cached(const std::string& target, std::chrono::seconds ttl);
+    std::vector<std::string> fetch_all_pages(const std::string& resource);
+    // Fetches pages [first, last] with up to kMaxPageFanout in flight: the
+    // caller works through pages itself and borrows helpers from page_pool_.
+    std::vector<std::string> fetch_pages(const std::string& target, int first, int last);
+    ResponseCache::Body aggregate_pages(const std::string& resource, bool bypass_cache = false);
+    CharacterPtr store_character(Character c);
+    std::vector<LocationPtr> get_locations_by_ids(const std::vector<int>& ids);
+    // Resolves residents and caches each location with its serialized body.
+    std::vector<LocationPtr> store_locations(std::vector<Location> locations);
+    // Serializes `l` with its residents (sorted by name) and caches it.
+    LocationPtr cache_location(Location l, std::vector<CharacterPtr> residents);
+    // Answers /api/character/?filters from the local index once every
+    // character is cached; null means the caller has to ask upstream.
+    ResponseCache::Body query_characters(const std::string& target);
+    std::shared_ptr<const CharacterIndex> character_index();
+
     HttpClient& client_;
-    std::unordered_map<int, Character> character_cache_;
+    ShardedCache<int, Character> character_cache_;
+    std::atomic<std::uint64_t> characters_generation_{0};
+    std::atomic<int> characters_upstream_count_{0};
+    mutable std::mutex all_characters_mutex_;
+    std::shared_ptr<const std::string> all_characters_json_;
+    std::uint64_t all_characters_generation_ = 0;
+    std::mutex character_index_mutex_;
+    std::shared_ptr<const CharacterIndex> character_index_;
+    std::uint64_t character_index_generation_ = 0;
+    ShardedCache<int, Episode> episode_cache_;
+    ShardedCache<int, Location> location_cache_;
+    std::atomic<std::uint64_t> locations_generation_{0};
+    std::atomic<int> locations_upstream_count_{0};
+    std::mutex all_locations_mutex_;
+    std::shared_ptr<const std::string> all_locations_json_;
+    std::uint64_t all_locations_generation_ = 0;
+    ResponseCache response_cache_;
+    SingleFlight<std::string> in_flight_;
+    HedgePolicy hedge_;
+    // Declared last so pending attempts are joined before anything they use.
+    std::unique_ptr<boost::asio::thread_pool> hedge_pool_;
+    // Shared by every fetch_pages() call, so concurrent misses queue for
+    // helpers instead of each spawning its own threads.
+    boost::asio::thread_pool page_pool_;
 };
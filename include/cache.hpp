@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "metrics.hpp"
+#include "trace.hpp"
+
+// Bytes a cached value holds outside the interned symbol arena; models.hpp
+// overloads it for the entity types.
+template<class Value>
+std::size_t entry_bytes(const Value&) { return sizeof(Value); }
+
+// Concurrent map handing out shared immutable handles. Keys are spread over
+// independent shards so readers only contend with writers of the same shard.
+template<class Key, class Value, std::size_t Shards = 16>
+class ShardedCache {
+public:
+    using Handle = std::shared_ptr<const Value>;
+
+    // Hits and misses of find(), and the bytes of every entry, are counted in
+    // `stats` when given.
+    explicit ShardedCache(CacheStats* stats = nullptr) : stats_(stats) {}
+
+    Handle find(const Key& key) const {
+        Span span("cache_lookup");
+        auto const& shard = shard_for(key);
+        std::shared_lock lock(shard.mutex);
+        if (auto it = shard.entries.find(key); it != shard.entries.end()) {
+            if (stats_) stats_->hits.add();
+            return it->second;
+        }
+        if (stats_) stats_->misses.add();
+        return nullptr;
+    }
+
+    // Like find(), but neither counted in the stats nor traced: for store
+    // paths that only check for an existing entry.
+    Handle peek(const Key& key) const {
+        auto const& shard = shard_for(key);
+        std::shared_lock lock(shard.mutex);
+        if (auto it = shard.entries.find(key); it != shard.entries.end())
+            return it->second;
+        return nullptr;
+    }
+
+    bool contains(const Key& key) const {
+        auto const& shard = shard_for(key);
+        std::shared_lock lock(shard.mutex);
+        return shard.entries.contains(key);
+    }
+
+    // Keeps the existing entry if the key is already cached.
+    Handle insert(const Key& key, Value value) {
+        auto handle = std::make_shared<const Value>(std::move(value));
+        auto& shard = shard_for(key);
+        std::unique_lock lock(shard.mutex);
+        auto [it, inserted] = shard.entries.try_emplace(key, std::move(handle));
+        if (inserted) {
+            size_.fetch_add(1, std::memory_order_relaxed);
+            if (stats_) stats_->bytes.add(entry_bytes(*it->second));
+        }
+        return it->second;
+    }
+
+    Handle assign(const Key& key, Value value) {
+        auto handle = std::make_shared<const Value>(std::move(value));
+        auto& shard = shard_for(key);
+        std::unique_lock lock(shard.mutex);
+        auto& slot = shard.entries[key];
+        std::size_t replaced = slot ? entry_bytes(*slot) : 0;
+        if (!slot)
+            size_.fetch_add(1, std::memory_order_relaxed);
+        // Unsigned wrap-around makes this a subtraction when the entry shrinks.
+        if (stats_) stats_->bytes.add(entry_bytes(*handle) - replaced);
+        slot = handle;
+        return handle;
+    }
+
+    // Kept as a counter so request paths can ask without locking any shard.
+    std::size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+    template<class F>
+    void for_each(F&& f) const {
+        for (auto const& shard : shards_) {
+            std::shared_lock lock(shard.mutex);
+            for (auto const& [key, handle] : shard.entries)
+                f(key, handle);
+        }
+    }
+
+private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<Key, Handle> entries;
+    };
+
+    Shard& shard_for(const Key& key) {
+        return shards_[std::hash<Key>{}(key) % Shards];
+    }
+    const Shard& shard_for(const Key& key) const {
+        return shards_[std::hash<Key>{}(key) % Shards];
+    }
+
+    std::array<Shard, Shards> shards_;
+    std::atomic<std::size_t> size_{0};
+    CacheStats* stats_;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+
+using Deadline = std::chrono::steady_clock::time_point;
+constexpr Deadline kNoDeadline = Deadline::max();
+
+// The request's time budget ran out before upstream answered.
+class DeadlineExceeded : public std::runtime_error {
+public:
+    DeadlineExceeded();
+};
+
+// Deadline of the request the calling thread works for, or kNoDeadline. The
+// API layer is synchronous and fans out across threads, so the budget travels
+// as a thread-local installed by DeadlineScope instead of as a parameter.
+Deadline current_deadline();
+
+// Throws DeadlineExceeded once the current deadline has passed.
+void check_deadline();
+
+class DeadlineScope {
+public:
+    explicit DeadlineScope(Deadline deadline);
+    ~DeadlineScope();
+
+    DeadlineScope(const DeadlineScope&) = delete;
+    DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+private:
+    Deadline previous_;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "models.hpp"
+
+// Streaming decoders for upstream bodies. They accept a single entity, an
+// array of entities or a paged {"info", "results"} envelope and build the
+// models straight from the parser events, without a JSON DOM. A body of the
+// form {"error": "..."} or malformed JSON throws std::runtime_error.
+template<class Model>
+struct Page {
+    int count = 0;
+    int pages = 0;
+    std::vector<Model> results;
+};
+
+struct PageInfo {
+    int count = 0;
+    int pages = 0;
+};
+
+Page<Character> decode_characters(std::string_view body);
+Page<Episode> decode_episodes(std::string_view body);
+Page<Location> decode_locations(std::string_view body);
+PageInfo decode_page_info(std::string_view body);
+
+// Id at the end of an upstream resource URL, e.g. ".../api/episode/28".
+std::optional<int> url_id(std::string_view url);
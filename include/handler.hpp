@@ -2,40 +2,101 @@
 
 #include <boost/beast/http.hpp>
 #include <boost/beast.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/use_awaitable.hpp>
 #include <boost/json.hpp>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include "api.hpp"
+#include "deadline.hpp"
+#include "retry.hpp"
+#include "route.hpp"
+#include "shared_body.hpp"
+#include "trace.hpp"
 
 namespace beast = boost::beast;
 namespace http  = beast::http;
+namespace net   = boost::asio;
 
 class Handler {
 public:
-    Handler(beast::tcp_stream& stream, RickAndMortyApi& api);
-    void handle();
+    Handler(beast::tcp_stream stream, RickAndMortyApi& api, net::thread_pool& upstream);
+    net::awaitable<void> handle();
 
 private:
 
-    void help(const http::request<http::string_body>& req);
-
-    void character_all(const http::request<http::string_body>& req);
-    void character_single(int id, const http::request<http::string_body>& req);
-    void character_batch(const std::string& id_part, const http::request<http::string_body>& req);
-	void character_query(const http::request<http::string_body>& req);
-	
-    void location_all(const http::request<http::string_body>& req);
-    void location_single(int id, const http::request<http::string_body>& req);
-    void location_batch(const std::string& id_part, const http::request<http::string_body>& req);
-    void location_query(const http::request<http::string_body>& req);
-
-	void episode_all(const http::request<http::string_body>& req);
-    void episode_single(int id, const http::request<http::string_body>& req);
-    void episode_batch(const std::string& id_part, const http::request<http::string_body>& req);
-    void episode_query(const http::request<http::string_body>& req);
-	
-    void route_request(const std::string& path, const http::request<http::string_body>& req);
-    void send_response(http::status status, const std::string& body, const http::request<http::string_body>& req);
-
-    beast::tcp_stream& stream_;
+    net::awaitable<void> help(const http::request<http::string_body>& req);
+    net::awaitable<void> metrics_text(const http::request<http::string_body>& req);
+    // /trace dumps the span rings as Chrome trace JSON; ?enable=1|0 toggles
+    // recording.
+    net::awaitable<void> trace_dump(const http::request<http::string_body>& req);
+
+    net::awaitable<void> character_all(const http::request<http::string_body>& req);
+    net::awaitable<void> character_all_streamed(const http::request<http::string_body>& req);
+    net::awaitable<void> character_single(int id, const http::request<http::string_body>& req);
+    net::awaitable<void> character_batch(std::string_view id_part, const http::request<http::string_body>& req);
+    net::awaitable<void> character_query(std::string_view query, const http::request<http::string_body>& req);
+
+    net::awaitable<void> location_all(const http::request<http::string_body>& req);
+    net::awaitable<void> location_single(int id, const http::request<http::string_body>& req);
+    net::awaitable<void> location_batch(std::string_view id_part, const http::request<http::string_body>& req);
+    net::awaitable<void> location_query(std::string_view query, const http::request<http::string_body>& req);
+
+    net::awaitable<void> episode_all(const http::request<http::string_body>& req);
+    net::awaitable<void> episode_single(int id, const http::request<http::string_body>& req);
+    net::awaitable<void> episode_batch(std::string_view id_part, const http::request<http::string_body>& req);
+    net::awaitable<void> episode_query(std::string_view query, const http::request<http::string_body>& req);
+
+    // Member pointers for one resource's endpoints, indexed by Resource.
+    struct Endpoints {
+        net::awaitable<void> (Handler::*index)(const http::request<http::string_body>& req);
+        net::awaitable<void> (Handler::*all)(const http::request<http::string_body>& req);
+        net::awaitable<void> (Handler::*single)(int id, const http::request<http::string_body>& req);
+        net::awaitable<void> (Handler::*batch)(std::string_view id_part, const http::request<http::string_body>& req);
+        net::awaitable<void> (Handler::*query)(std::string_view query, const http::request<http::string_body>& req);
+    };
+
+    net::awaitable<void> route_request(std::string_view target, const http::request<http::string_body>& req);
+    void send_response(http::status status, ResponseCache::Body body, const http::request<http::string_body>& req);
+    void send_response(http::status status, std::string body, const http::request<http::string_body>& req);
+    net::awaitable<void> write_chunk(const std::string& data);
+
+    // Runs a blocking upstream call on the upstream pool so the connection's
+    // executor stays free to serve other clients while it waits. The call
+    // sees the request's deadline and trace id through thread-local scopes.
+    template<class F>
+    net::awaitable<std::invoke_result_t<F&>> offload(F&& f) {
+        using R = std::invoke_result_t<F&>;
+        co_return co_await net::co_spawn(upstream_,
+            [&]() -> net::awaitable<R> {
+                DeadlineScope scope(deadline_);
+                TraceScope trace(trace_id_);
+                co_return f();
+            },
+            net::use_awaitable);
+    }
+
+    // offload() with transient upstream failures retried after a jittered
+    // backoff that waits on a timer instead of blocking a thread, for as long
+    // as the request's budget allows.
+    template<class F>
+    net::awaitable<std::invoke_result_t<F&>> upstream_call(F&& f) {
+        RetryPolicy policy;
+        policy.deadline = deadline_;
+        co_return co_await with_retry([&]{ return offload(f); }, policy);
+    }
+
+    beast::tcp_stream stream_;
     RickAndMortyApi& api_;
+    net::thread_pool& upstream_;
+    beast::flat_buffer buffer_;
+    http::response<shared_string_body> res_;
+    // Budget of the request being served, set once it has been read.
+    Deadline deadline_ = kNoDeadline;
+    std::uint64_t trace_id_ = 0;
+    // Set once a route has written its own (chunked) response to the stream.
+    bool streamed_ = false;
 };
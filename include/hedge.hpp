@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+// Decides when a backup upstream request is worth sending. The delay tracks a
+// high percentile of recent upstream latencies, so only the slow tail gets a
+// second attempt, and a token budget earned per request caps hedges to a
+// fixed fraction of upstream traffic.
+class HedgePolicy {
+public:
+    using Duration = std::chrono::microseconds;
+
+    explicit HedgePolicy(double budget = 0.05, double quantile = 0.95);
+
+    // How long to wait for the first attempt before hedging.
+    Duration delay() const;
+    void record(Duration latency);
+
+    // Every request earns `budget` tokens; a hedge spends one.
+    void on_request();
+    bool try_acquire();
+
+private:
+    static constexpr std::size_t kWindow = 256;
+
+    mutable std::mutex mutex_;
+    std::array<Duration, kWindow> samples_{};
+    std::size_t recorded_ = 0;
+    Duration delay_;
+    double tokens_ = 0;
+    double budget_;
+    double quantile_;
+};
@@ -1,11 +1,22 @@
 #pragma once
 
+#include <memory>
 #include <string>
 
 class HttpClient {
 public:
     explicit HttpClient(bool verbose = false);
-    std::string get(const std::string& host, const std::string& target);
+    virtual ~HttpClient();
+    // Throws UpstreamError on 429/5xx and CircuitOpenError while the host's
+    // circuit breaker is open; other statuses return the body as is. Connect,
+    // handshake and the exchange are bounded by the caller's deadline (see
+    // DeadlineScope) and by a per-call I/O timeout. `host` may name a port
+    // ("localhost:8443"); 443 otherwise. Virtual so tests can stand in for
+    // upstream.
+    virtual std::string get(const std::string& host, const std::string& target);
 private:
+    struct Pool;
+    std::string perform(const std::string& host, const std::string& target);
     bool verbose_;
+    std::unique_ptr<Pool> pool_;
 };
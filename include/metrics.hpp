@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "route.hpp"
+
+// Every metric is split over kMetricSlots cache-line sized slots and each
+// thread sticks to one of them, so recording is an uncontended relaxed add
+// and only rendering walks all slots.
+inline constexpr std::size_t kMetricSlots = 16;
+
+inline std::size_t metric_slot() {
+    static std::atomic<std::size_t> next{0};
+    thread_local const std::size_t slot = next.fetch_add(1, std::memory_order_relaxed) % kMetricSlots;
+    return slot;
+}
+
+class Counter {
+public:
+    void add(std::uint64_t n = 1) {
+        slots_[metric_slot()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t value() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> value{0};
+    };
+    std::array<Slot, kMetricSlots> slots_;
+};
+
+// Latency histogram with fixed bucket bounds; rendered in seconds.
+class Histogram {
+public:
+    // Upper bucket bounds in microseconds.
+    static constexpr std::array<std::uint64_t, 12> kBounds{
+        1'000, 5'000, 10'000, 25'000, 50'000, 100'000,
+        250'000, 500'000, 1'000'000, 2'500'000, 5'000'000, 10'000'000,
+    };
+
+    struct Totals {
+        // Non-cumulative; the last bucket is everything above kBounds.back().
+        std::array<std::uint64_t, kBounds.size() + 1> buckets{};
+        std::uint64_t count = 0;
+        std::uint64_t sum_us = 0;
+    };
+
+    void observe(std::chrono::steady_clock::duration elapsed) {
+        auto us = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        std::size_t bucket = 0;
+        while (bucket < kBounds.size() && us > kBounds[bucket])
+            ++bucket;
+
+        auto& slot = slots_[metric_slot()];
+        slot.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        slot.sum_us.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    Totals totals() const;
+
+private:
+    struct alignas(64) Slot {
+        std::array<std::atomic<std::uint64_t>, kBounds.size() + 1> buckets{};
+        std::atomic<std::uint64_t> sum_us{0};
+    };
+    std::array<Slot, kMetricSlots> slots_;
+};
+
+// Records the lifetime of the scope into a histogram.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { histogram_.observe(std::chrono::steady_clock::now() - start_); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+struct CacheStats {
+    Counter hits;
+    Counter misses;
+    Counter evictions;
+    // Held by the entity caches; ResponseCache tracks its own bytes().
+    Counter bytes;
+};
+
+struct UpstreamStats {
+    Histogram latency;
+    Counter errors;
+};
+
+// Process-wide instruments, rendered by /metrics.
+class Metrics {
+public:
+    static constexpr std::size_t kResources = static_cast<std::size_t>(Resource::Trace) + 1;
+    static constexpr std::size_t kShapes = static_cast<std::size_t>(Shape::Query) + 1;
+
+    Histogram& request(const Route& route) {
+        return requests_[static_cast<std::size_t>(route.resource) * kShapes + static_cast<std::size_t>(route.shape)];
+    }
+    // Keyed by the resource in an upstream target such as /api/character/1.
+    UpstreamStats& upstream(std::string_view target);
+
+    Counter retries;
+    CacheStats characters;
+    CacheStats episodes;
+    CacheStats locations;
+    CacheStats responses;
+
+    // Prometheus text exposition format, version 0.0.4.
+    std::string render() const;
+
+private:
+    std::array<Histogram, kResources * kShapes> requests_;
+    std::array<UpstreamStats, kResources> upstream_;
+};
+
+Metrics& metrics();
@@ -1,22 +1,58 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "symbol.hpp"
+
 struct Character {
     int id{};
-    std::string name;
-    std::string status;
-    std::string species;
-    std::string gender;
-    std::string origin_name;
-    std::string location_name;
+    Symbol name;
+    Symbol status;
+    Symbol species;
+    Symbol type;
+    Symbol gender;
+    Symbol origin_name;
+    Symbol location_name;
+    int origin_id{};    // 0 when upstream has no location for it
+    int location_id{};
     std::vector<int> episode_ids;
+    Symbol created;
+    std::string serialized;
 };
 
 struct Episode {
-    std::string name;
-    std::string episode;
-    std::string air_date;
-    std::vector<std::string> characters;
+    int id{};
+    Symbol name;
+    Symbol episode;
+    Symbol air_date;
+    std::vector<int> character_ids;
 };
+
+struct Location {
+    int id{};
+    Symbol name;
+    Symbol type;
+    Symbol dimension;
+    std::vector<int> resident_ids;
+    Symbol created;
+    std::string serialized;
+};
+
+// Bytes an entity holds outside the symbol arena, for the cache_entry_bytes
+// gauge. The pre-rendered body is usually the largest part.
+inline std::size_t entry_bytes(const Character& c) {
+    return sizeof(c) + c.episode_ids.capacity() * sizeof(int) + c.serialized.capacity();
+}
+inline std::size_t entry_bytes(const Episode& e) {
+    return sizeof(e) + e.character_ids.capacity() * sizeof(int);
+}
+inline std::size_t entry_bytes(const Location& l) {
+    return sizeof(l) + l.resident_ids.capacity() * sizeof(int) + l.serialized.capacity();
+}
+
+using CharacterPtr = std::shared_ptr<const Character>;
+using EpisodePtr   = std::shared_ptr<const Episode>;
+using LocationPtr  = std::shared_ptr<const Location>;
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "models.hpp"
+
+// Filters accepted by upstream /api/character/?... Name, species and type
+// match case-insensitive substrings; status and gender match the whole value,
+// also ignoring case.
+struct CharacterQuery {
+    std::optional<std::string> name;
+    std::optional<std::string> status;
+    std::optional<std::string> species;
+    std::optional<std::string> type;
+    std::optional<std::string> gender;
+    int page = 1;
+    std::string filters;    // raw query without `page`, for info.next/prev
+};
+
+// Null when the query has a parameter the local index cannot answer, in which
+// case it should be forwarded upstream.
+std::optional<CharacterQuery> parse_character_query(std::string_view query);
+
+// Inverted indexes over the full character set: one posting list per distinct
+// status, species, type and gender, and one per lowercase trigram of the name.
+class CharacterIndex {
+public:
+    explicit CharacterIndex(std::vector<CharacterPtr> characters);
+
+    // Matching characters in id order, as upstream returns them.
+    std::vector<CharacterPtr> match(const CharacterQuery& q) const;
+
+    std::size_t size() const { return characters_.size(); }
+
+private:
+    using Postings   = std::vector<std::uint32_t>;
+    using ValueIndex = std::unordered_map<std::string, Postings>;
+
+    std::vector<CharacterPtr> characters_;
+    std::vector<std::string> names_;
+    ValueIndex status_;
+    ValueIndex species_;
+    ValueIndex type_;
+    ValueIndex gender_;
+    ValueIndex name_trigrams_;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "metrics.hpp"
+
+// Upstream response bodies keyed by normalized target. Entries expire after
+// their TTL but stay around as stale copies until the least recently used
+// ones are evicted to respect the byte budget.
+class ResponseCache {
+public:
+    using Body  = std::shared_ptr<const std::string>;
+    using Clock = std::chrono::steady_clock;
+
+    explicit ResponseCache(std::size_t max_bytes, CacheStats* stats = nullptr);
+
+    // Null once the entry has expired.
+    Body get(const std::string& key);
+    // Ignores expiry; used to answer while upstream is unavailable.
+    Body get_stale(const std::string& key);
+    Body put(const std::string& key, std::string body, std::chrono::seconds ttl);
+
+    std::size_t bytes() const;
+    std::size_t size() const;
+
+private:
+    struct Entry {
+        std::string key;
+        Body body;
+        Clock::time_point expires;
+    };
+
+    void erase_locked(std::list<Entry>::iterator it);
+
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::size_t max_bytes_;
+    std::size_t bytes_ = 0;
+    CacheStats* stats_;
+};
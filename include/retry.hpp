@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "deadline.hpp"
+#include "metrics.hpp"
+
+// Upstream answered with a status that says nothing about the request itself
+// (429 or 5xx). 4xx bodies are returned to the caller as usual.
+class UpstreamError : public std::runtime_error {
+public:
+    explicit UpstreamError(int status);
+    int status() const { return status_; }
+
+private:
+    int status_;
+};
+
+// Thrown without touching the network while the host's breaker is open.
+class CircuitOpenError : public std::runtime_error {
+public:
+    explicit CircuitOpenError(const std::string& host);
+};
+
+// Counts consecutive failures for one upstream host. Once `threshold` is
+// reached the circuit opens and calls fail fast for `cooldown`; after that a
+// single probe is let through, and its outcome closes or reopens it.
+class CircuitBreaker {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit CircuitBreaker(int threshold = 5, Clock::duration cooldown = std::chrono::seconds(10));
+
+    bool allow();
+    void on_success();
+    void on_failure();
+    // The call ended without saying anything about upstream (e.g. the
+    // caller's deadline passed); a half-open probe is released unjudged.
+    void on_abandoned();
+    bool open() const;
+
+private:
+    enum class State { Closed, Open, HalfOpen };
+
+    mutable std::mutex mutex_;
+    State state_ = State::Closed;
+    int failures_ = 0;
+    int threshold_;
+    Clock::duration cooldown_;
+    Clock::time_point opened_at_;
+};
+
+struct RetryPolicy {
+    int attempts = 3;
+    std::chrono::milliseconds base{100};
+    std::chrono::milliseconds cap{2000};
+    // No attempt starts after this; a backoff that would cross it gives up.
+    Deadline deadline = kNoDeadline;
+};
+
+// Network, TLS and timeout errors and 429/5xx are worth another attempt;
+// decode errors, upstream 4xx payloads, an open circuit and an exhausted
+// deadline are not.
+bool is_retryable(std::exception_ptr error);
+
+// Exponential backoff with full jitter: uniform in [0, min(cap, base * 2^n)).
+std::chrono::milliseconds backoff_delay(const RetryPolicy& policy, int attempt);
+
+// Awaits `attempt()` until it succeeds, fails with a non-retryable error or
+// runs out of attempts. Backoff waits on a timer, so the calling executor
+// keeps serving other work in between.
+template<class Attempt>
+auto with_retry(Attempt attempt, RetryPolicy policy = {})
+    -> boost::asio::awaitable<typename std::invoke_result_t<Attempt&>::value_type> {
+    boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+
+    for (int i = 1;; ++i) {
+        std::exception_ptr error;
+        try {
+            co_return co_await attempt();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+
+        if (i >= policy.attempts || !is_retryable(error))
+            std::rethrow_exception(error);
+
+        auto delay = backoff_delay(policy, i);
+        if (policy.deadline != kNoDeadline && std::chrono::steady_clock::now() + delay >= policy.deadline)
+            throw DeadlineExceeded();
+
+        metrics().retries.add();
+        timer.expires_after(delay);
+        co_await timer.async_wait(boost::asio::use_awaitable);
+    }
+}
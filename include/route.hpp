@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+enum class Resource { Help, Character, Location, Episode, Metrics, Trace };
+
+// What follows the resource segment: nothing (/help, /metrics, /trace), "all", one id, a comma
+// separated id list or a "?key=value" query.
+enum class Shape { NotFound, Index, All, Single, Batch, Query };
+
+struct Route {
+    Resource resource = Resource::Help;
+    Shape shape = Shape::NotFound;
+    int id = 0;
+    std::string_view ids;
+    std::string_view query;
+};
+
+namespace route_detail {
+struct Entry {
+    std::string_view name;
+    Resource resource;
+};
+
+inline constexpr std::array<Entry, 6> kResources{{
+    {"help",      Resource::Help},
+    {"character", Resource::Character},
+    {"location",  Resource::Location},
+    {"episode",   Resource::Episode},
+    {"metrics",   Resource::Metrics},
+    {"trace",     Resource::Trace},
+}};
+
+// Perfect hash over the first path segment: length and first letter put each
+// resource in its own slot, so lookup is one probe and one compare.
+inline constexpr std::size_t kSlots = 16;
+
+constexpr std::size_t slot(std::string_view segment) {
+    return (segment.size() * 2 + static_cast<unsigned char>(segment.front())) % kSlots;
+}
+
+constexpr std::array<int, kSlots> build_table() {
+    std::array<int, kSlots> table{};
+    table.fill(-1);
+    for (std::size_t i = 0; i < kResources.size(); ++i)
+        table[slot(kResources[i].name)] = static_cast<int>(i);
+    return table;
+}
+
+inline constexpr auto kTable = build_table();
+
+constexpr bool collision_free() {
+    for (std::size_t i = 0; i < kResources.size(); ++i) {
+        if (kTable[slot(kResources[i].name)] != static_cast<int>(i))
+            return false;
+    }
+    return true;
+}
+
+static_assert(collision_free(), "two resources hash to the same slot; adjust slot()");
+}
+
+constexpr std::optional<Resource> find_resource(std::string_view segment) {
+    if (segment.empty())
+        return std::nullopt;
+    int i = route_detail::kTable[route_detail::slot(segment)];
+    if (i < 0 || route_detail::kResources[i].name != segment)
+        return std::nullopt;
+    return route_detail::kResources[i].resource;
+}
+
+// Splits a request target into resource and shape without allocating. The
+// returned views point into `target`.
+Route match_route(std::string_view target);
+
+// Parses "1,2,3" into ids; empty items are skipped. False if any item is not
+// a non-negative integer.
+bool parse_id_list(std::string_view list, std::vector<int>& ids);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "models.hpp"
+
+// Response bodies produced by the middleware itself (as opposed to upstream
+// pass-through). Computed once per cached entity or aggregate.
+std::string serialize_character(const Character& c);
+std::string serialize_character_list(const std::vector<CharacterPtr>& characters);
+
+// Comma-separated {"id","name"} entries of a character list, without the
+// enclosing array, so a list can be written out in pieces.
+std::string serialize_character_entries(const std::vector<CharacterPtr>& characters);
+
+// /location/<id>, with residents resolved to {"id","name"} in name order.
+std::string serialize_location(const Location& l, const std::vector<CharacterPtr>& residents);
+// {"locations":[{"id","name","type","dimension"}]}
+std::string serialize_location_list(const std::vector<LocationPtr>& locations);
+
+// One page of filter results in upstream's {"info", "results"} format, with
+// full upstream character objects. `filters` is appended to info.next/prev.
+// Pages past the end yield upstream's {"error":"There is nothing here"}.
+std::string serialize_character_page(const std::vector<CharacterPtr>& matches, int page,
+                                     std::string_view filters);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <exception>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "deadline.hpp"
+
+// Collapses concurrent calls with the same key into one execution; every
+// caller receives that execution's result or exception. A caller that joins
+// someone else's call waits no longer than its own deadline, and one whose
+// leader ran out of the leader's budget tries again on its own.
+template<class T>
+class SingleFlight {
+public:
+    template<class F>
+    T run(const std::string& key, F&& f) {
+        std::unique_lock lock(mutex_);
+        for (auto it = calls_.find(key); it != calls_.end(); it = calls_.find(key)) {
+            auto pending = it->second;
+            lock.unlock();
+            auto deadline = current_deadline();
+            if (deadline != kNoDeadline && pending.wait_until(deadline) == std::future_status::timeout)
+                throw DeadlineExceeded();
+            try {
+                return pending.get();
+            }
+            catch (DeadlineExceeded const&) {
+                if (std::chrono::steady_clock::now() >= deadline)
+                    throw;
+            }
+            lock.lock();
+        }
+
+        std::promise<T> promise;
+        calls_.emplace(key, promise.get_future().share());
+        lock.unlock();
+
+        try {
+            T value = f();
+            finish(key);
+            promise.set_value(value);
+            return value;
+        }
+        catch (...) {
+            finish(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+private:
+    void finish(const std::string& key) {
+        std::lock_guard lock(mutex_);
+        calls_.erase(key);
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_future<T>> calls_;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "models.hpp"
+
+// Binary image of the typed caches: a fixed header (magic, version, creation
+// time, payload size and FNV-1a checksum) followed by the character upstream
+// count and length-prefixed records.
+// Readers map the file and decode straight from the mapping.
+struct Snapshot {
+    std::chrono::system_clock::time_point created;
+    std::vector<Character> characters;
+    std::vector<Episode> episodes;
+    std::vector<Location> locations;
+    // Upstream info.count for characters when the snapshot was taken, 0 if
+    // it was not known yet.
+    int character_upstream_count = 0;
+};
+
+bool write_snapshot(const std::string& path,
+                    const std::vector<CharacterPtr>& characters,
+                    const std::vector<EpisodePtr>& episodes,
+                    const std::vector<LocationPtr>& locations,
+                    int character_upstream_count = 0);
+
+std::optional<Snapshot> read_snapshot(const std::string& path, std::chrono::seconds max_age);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Immutable, interned text used by the cached models. Every distinct string is
+// copied once into a process-wide append-only arena, so equal symbols share
+// storage and compare by address. A Symbol is a pointer and a length.
+class Symbol {
+public:
+    Symbol() = default;
+    Symbol(std::string_view s);
+    Symbol(const char* s) : Symbol(std::string_view(s)) {}
+    Symbol(const std::string& s) : Symbol(std::string_view(s)) {}
+
+    std::string_view view() const { return {data_, size_}; }
+    operator std::string_view() const { return view(); }
+    std::string str() const { return std::string(view()); }
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    friend bool operator==(Symbol a, Symbol b) { return a.data_ == b.data_; }
+    friend std::ostream& operator<<(std::ostream& os, Symbol s) { return os << s.view(); }
+
+private:
+    const char* data_ = nullptr;
+    std::uint32_t size_ = 0;
+};
+
+std::size_t symbol_arena_bytes();
+
+template<>
+struct std::hash<Symbol> {
+    std::size_t operator()(Symbol s) const noexcept {
+        return std::hash<const char*>{}(s.data());
+    }
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Per-request phase spans. Each thread records into its own fixed-size ring
+// with plain atomic stores, so a span costs two clock reads while tracing is
+// on and one relaxed load while it is off (the default).
+namespace trace_detail {
+inline std::atomic<bool> enabled{false};
+}
+
+inline bool tracing_enabled() {
+    return trace_detail::enabled.load(std::memory_order_relaxed);
+}
+void set_tracing(bool on);
+
+// Microseconds since the process started tracing's clock.
+std::int64_t trace_now_us();
+
+// Id of the request the calling thread works for, 0 outside of requests.
+// Installed like DeadlineScope, so upstream and fan-out threads inherit it.
+std::uint64_t current_trace_id();
+std::uint64_t next_trace_id();
+
+class TraceScope {
+public:
+    explicit TraceScope(std::uint64_t id);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    std::uint64_t previous_;
+};
+
+// Records [construction, destruction) under `name`, which must be a string
+// literal: rings keep the pointer, not a copy.
+class Span {
+public:
+    explicit Span(const char* name) : Span(name, current_trace_id()) {}
+    Span(const char* name, std::uint64_t request)
+        : name_(name), request_(request), start_us_(tracing_enabled() ? trace_now_us() : -1) {}
+    ~Span() {
+        if (start_us_ >= 0)
+            finish();
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    void finish();
+
+    const char* name_;
+    std::uint64_t request_;
+    std::int64_t start_us_;
+};
+
+// Every span still held by the rings as Chrome trace-event JSON, one row
+// (tid) per request.
+std::string export_chrome_trace();
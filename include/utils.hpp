@@ -1,6 +1,12 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 std::pair<std::string, std::string> parse_https_url(const std::string& url);
+std::string normalize_target(const std::string& target);
+
+// Splits "a=1&b=x%20y" into percent-decoded key/value pairs, in order.
+std::vector<std::pair<std::string, std::string>> parse_query(std::string_view query);
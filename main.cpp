@@ -9,6 +9,12 @@
 #include <boost/url.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <thread>
+#include <vector>
 #include <boost/beast.hpp>
 #include <boost/asio.hpp>
 #include "handler.hpp"
@@ -18,22 +24,118 @@
 namespace net   = boost::asio;
 namespace beast = boost::beast;
 
-int main() {
+net::awaitable<void> session(net::ip::tcp::socket socket, RickAndMortyApi& api, net::thread_pool& upstream) {
+    Handler middleware(beast::tcp_stream(std::move(socket)), api, upstream);
+    co_await middleware.handle();
+}
+
+// Accept errors are logged and skipped so one bad connection, or a moment
+// without free descriptors, never stops the server from accepting.
+net::awaitable<void> accept_loop(net::ip::tcp::acceptor& acceptor, RickAndMortyApi& api, net::thread_pool& upstream) {
+    net::steady_timer backoff(co_await net::this_coro::executor);
+    for (;;) {
+        boost::system::error_code ec;
+        auto socket = co_await acceptor.async_accept(
+            net::make_strand(acceptor.get_executor()), net::redirect_error(net::use_awaitable, ec));
+        if (ec == net::error::operation_aborted)
+            co_return;
+        if (ec) {
+            std::cerr << "Accept failed: " << ec.message() << "\n";
+            if (ec == net::error::no_descriptors || ec == boost::system::errc::too_many_files_open_in_system ||
+                ec == net::error::no_buffer_space || ec == net::error::no_memory) {
+                backoff.expires_after(std::chrono::milliseconds(100));
+                co_await backoff.async_wait(net::redirect_error(net::use_awaitable, ec));
+            }
+            continue;
+        }
+
+        auto ex = socket.get_executor();
+        net::co_spawn(ex, session(std::move(socket), api, upstream), net::detached);
+    }
+}
+
+// Saves on the background pool so the cache walk and file write never take
+// an upstream slot from a client request.
+net::awaitable<void> snapshot_loop(RickAndMortyApi& api, net::thread_pool& background, std::string path) {
+    net::steady_timer timer(co_await net::this_coro::executor);
+    for (;;) {
+        timer.expires_after(std::chrono::minutes(5));
+        co_await timer.async_wait(net::use_awaitable);
+        net::post(background, [&api, path]{ api.save_snapshot(path); });
+    }
+}
+
+// Warms the caches at startup, then periodically pulls in whatever upstream
+// added. Runs on its own single-thread pool, and the API fetches its pages
+// sequentially without hedging, so background work never takes a page or
+// hedge thread from a client request.
+net::awaitable<void> refresh_loop(RickAndMortyApi& api, net::thread_pool& background) {
+    net::post(background, [&api]{
+        try { api.warm_up(); }
+        catch (std::exception const& e) { std::cerr << "Warm-up failed: " << e.what() << "\n"; }
+    });
+
+    net::steady_timer timer(co_await net::this_coro::executor);
+    for (;;) {
+        timer.expires_after(std::chrono::minutes(5));
+        co_await timer.async_wait(net::use_awaitable);
+        net::post(background, [&api]{
+            try { api.refresh(); }
+            catch (std::exception const& e) { std::cerr << "Refresh failed: " << e.what() << "\n"; }
+        });
+    }
+}
+
+int main(int argc, char* argv[]) {
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    unsigned threads          = std::max(1ul, argc > 1 ? std::stoul(argv[1]) : hw);
+    unsigned upstream_threads = std::max(1ul, argc > 2 ? std::stoul(argv[2]) : threads * 4ul);
+    std::size_t cache_mb      = argc > 3 ? std::stoul(argv[3]) : 64;
+    std::string snapshot_path = argc > 4 ? argv[4] : "rick_cache.bin";
+    bool hedging              = argc > 5 && std::string(argv[5]) == "1";
+
     HttpClient client(false);
-    RickAndMortyApi api(client);
+    RickAndMortyApi api(client, cache_mb * 1024 * 1024);
+    if (hedging)
+        api.enable_hedging(upstream_threads * 2);
+
+    try {
+        if (auto loaded = api.load_snapshot(snapshot_path, std::chrono::hours(24)))
+            std::cout << "Loaded " << loaded << " cached entries from " << snapshot_path << "\n";
+    }
+    catch (std::exception const& e) {
+        std::cerr << "Snapshot load failed: " << e.what() << "\n";
+    }
 
-    net::io_context ioc;
+    net::io_context ioc{static_cast<int>(threads)};
+    net::thread_pool upstream{upstream_threads};
+    net::thread_pool background{1};
     net::ip::tcp::acceptor acceptor{ioc, {net::ip::tcp::v4(), 8080}};
 
-    std::cout << "Middleware started at port 8080\n";
+    net::co_spawn(ioc, accept_loop(acceptor, api, upstream), net::detached);
+    net::co_spawn(ioc, snapshot_loop(api, background, snapshot_path), net::detached);
+    net::co_spawn(ioc, refresh_loop(api, background), net::detached);
 
-    while (true) {
-        auto socket = acceptor.accept();
-        beast::tcp_stream stream(std::move(socket));
+    // The accept, snapshot and refresh loops never run out of work, so
+    // ioc.run() only returns once a signal stops it; the pools then drain
+    // and the caches are saved one last time.
+    net::signal_set signals{ioc, SIGINT, SIGTERM};
+    signals.async_wait([&](boost::system::error_code const&, int) { ioc.stop(); });
 
-        Handler middleware(stream, api);
-        middleware.handle();
-    }
+    std::cout << "Middleware started at port 8080 (" << threads << " workers, "
+              << upstream_threads << " upstream)\n";
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back([&ioc]{ ioc.run(); });
+    ioc.run();
+
+    for (auto& t : workers)
+        t.join();
 
+    background.join();
+    upstream.join();
+    api.save_snapshot(snapshot_path);
     return 0;
 }
@@ -1,165 +1,557 @@
 #include "api.hpp"
 #include "utils.hpp"
 #include "models.hpp"
+#include "snapshot.hpp"
+#include "deadline.hpp"
+#include "decoder.hpp"
+#include "metrics.hpp"
+#include "serialize.hpp"
+#include "trace.hpp"
+#include "query.hpp"
+#include "retry.hpp"
+#include <boost/asio/post.hpp>
 #include <boost/json.hpp>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <stdexcept>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
 
 namespace json = boost::json;
 
-RickAndMortyApi::RickAndMortyApi(HttpClient& client) : client_(client) {}
+namespace {
+constexpr int kMaxPageFanout = 8;
+constexpr int kPagePoolThreads = 16;
+constexpr size_t kMaxIdsPerRequest = 100;
 
-Character RickAndMortyApi::parse_character(const json::object& obj) {
-    Character c;
-    c.id      = obj.at("id").as_int64();
-    c.name    = obj.at("name").as_string().c_str();
-    c.status  = obj.at("status").as_string().c_str();
-    c.species = obj.at("species").as_string().c_str();
-    c.gender  = obj.at("gender").as_string().c_str();
-    c.origin_name   = obj.at("origin").as_object().at("name").as_string().c_str();
-    c.location_name = obj.at("location").as_object().at("name").as_string().c_str();
+constexpr auto kEntityTtl    = std::chrono::hours(1);
+constexpr auto kAggregateTtl = std::chrono::minutes(10);
+constexpr auto kQueryTtl     = std::chrono::minutes(5);
 
-    for (auto const& epv : obj.at("episode").as_array()) {
-        auto url = std::string(epv.as_string().c_str());
-        auto pos = url.find_last_of('/');
-        if (pos != std::string::npos)
-            c.episode_ids.push_back(std::stoi(url.substr(pos+1)));
-    }
-    return c;
+bool is_error_body(const std::string& body) {
+    return body.starts_with(R"({"error")");
 }
 
-Character RickAndMortyApi::get_character(int id) {
-    if (auto it = character_cache_.find(id); it != character_cache_.end()) {
-        return it->second;
+// Upstream cannot answer right now (open circuit) or not within the request's
+// budget; an expired cached copy beats an error in both cases.
+bool upstream_unavailable(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    }
+    catch (CircuitOpenError const&) {
+        return true;
+    }
+    catch (DeadlineExceeded const&) {
+        return true;
     }
+    catch (...) {
+        return false;
+    }
+}
 
-    const std::string host = "rickandmortyapi.com";
-    const std::string target = "/api/character/" + std::to_string(id);
+// Set while warm_up() or refresh() runs. Background work has no client
+// waiting on it, so it fetches pages one at a time and never hedges, leaving
+// page_pool_, hedge_pool_ and the hedge budget to client requests.
+thread_local bool background_work = false;
+
+struct BackgroundScope {
+    bool previous = std::exchange(background_work, true);
+    ~BackgroundScope() { background_work = previous; }
+};
+
+// Shared by the attempts of one hedged GET; the first body wins.
+struct HedgeRace {
+    std::mutex mutex;
+    std::condition_variable done;
+    std::optional<std::string> body;
+    std::exception_ptr error;
+    int pending = 0;
+};
+}
 
-    auto body = client_.get(host, target);
-    auto obj  = json::parse(body).as_object();
+RickAndMortyApi::RickAndMortyApi(HttpClient& client, std::size_t response_cache_bytes)
+    : client_(client),
+      character_cache_(&metrics().characters),
+      episode_cache_(&metrics().episodes),
+      location_cache_(&metrics().locations),
+      response_cache_(response_cache_bytes, &metrics().responses),
+      page_pool_(kPagePoolThreads) {}
+
+std::string RickAndMortyApi::fetch(const std::string& target) {
+    return in_flight_.run(normalize_target(target), [&]{
+        return hedge_pool_ && !background_work ? hedged_get(target) : timed_get(target);
+    });
+}
 
-    Character c = parse_character(obj);
-    character_cache_.emplace(c.id, c);
+void RickAndMortyApi::enable_hedging(unsigned threads) {
+    hedge_pool_ = std::make_unique<boost::asio::thread_pool>(threads);
+}
+
+std::string RickAndMortyApi::timed_get(const std::string& target) {
+    auto start = std::chrono::steady_clock::now();
+    auto body = client_.get("rickandmortyapi.com", target);
+    hedge_.record(std::chrono::duration_cast<HedgePolicy::Duration>(std::chrono::steady_clock::now() - start));
+    return body;
+}
 
-    return c;
+std::string RickAndMortyApi::hedged_get(const std::string& target) {
+    auto race = std::make_shared<HedgeRace>();
+    auto attempt = [this, race, target, deadline = current_deadline(), id = current_trace_id()] {
+        DeadlineScope scope(deadline);
+        TraceScope trace(id);
+        std::optional<std::string> body;
+        std::exception_ptr error;
+        try { body = timed_get(target); }
+        catch (...) { error = std::current_exception(); }
+
+        std::lock_guard lock(race->mutex);
+        --race->pending;
+        if (body && !race->body)
+            race->body = std::move(body);
+        else if (error && !race->error)
+            race->error = error;
+        race->done.notify_all();
+    };
+
+    hedge_.on_request();
+    std::unique_lock lock(race->mutex);
+    race->pending = 1;
+    boost::asio::post(*hedge_pool_, attempt);
+
+    // The loser keeps running to completion; its connection goes back to the
+    // pool and its latency still feeds the delay estimate.
+    auto finished = [&]{ return race->body || race->pending == 0; };
+    if (!race->done.wait_for(lock, hedge_.delay(), finished) && hedge_.try_acquire()) {
+        ++race->pending;
+        boost::asio::post(*hedge_pool_, attempt);
+    }
+    if (current_deadline() == kNoDeadline)
+        race->done.wait(lock, finished);
+    else if (!race->done.wait_until(lock, current_deadline(), finished))
+        throw DeadlineExceeded();
+
+    if (race->body)
+        return std::move(*race->body);
+    std::rethrow_exception(race->error);
 }
 
-std::vector<Character> RickAndMortyApi::get_characters_page(int page) {
-    const std::string host = "rickandmortyapi.com";
-    const std::string target = "/api/character?page=" + std::to_string(page);
+ResponseCache::Body RickAndMortyApi::fetch_cached(const std::string& target, std::chrono::seconds ttl) {
+    auto key = normalize_target(target);
+    if (auto cached = response_cache_.get(key)) {
+        return cached;
+    }
 
-    auto body = client_.get(host, target);
-    auto root = json::parse(body).as_object();
-    auto arr  = root.at("results").as_array();
+    std::string body;
+    try {
+        body = fetch(target);
+    }
+    catch (...) {
+        if (upstream_unavailable(std::current_exception()))
+            if (auto stale = response_cache_.get_stale(key))
+                return stale;
+        throw;
+    }
 
-    std::vector<Character> out;
-    out.reserve(arr.size());
+    if (is_error_body(body)) {
+        return std::make_shared<const std::string>(std::move(body));
+    }
+    return response_cache_.put(key, std::move(body), ttl);
+}
 
-    for (auto const& v : arr) {
-        auto cobj = v.as_object();
-        int cid   = cobj.at("id").as_int64();
+CharacterPtr RickAndMortyApi::get_character(int id) {
+    if (auto cached = character_cache_.find(id)) {
+        return cached;
+    }
 
-        if (auto it = character_cache_.find(cid); it != character_cache_.end()) {
-            out.push_back(it->second);
-        } else {
-            Character c = parse_character(cobj);
-            character_cache_.emplace(c.id, c);
-            out.push_back(c);
+    const std::string target = "/api/character/" + std::to_string(id);
+
+    auto page = decode_characters(fetch(target));
+    if (page.results.size() != 1)
+        throw std::runtime_error("unexpected character payload");
+
+    return store_character(std::move(page.results.front()));
+}
+
+std::vector<CharacterPtr> RickAndMortyApi::get_characters_page(int page) {
+    return get_characters_pages(page, page).results;
+}
+
+Page<CharacterPtr> RickAndMortyApi::get_characters_pages(int first, int last) {
+    Page<CharacterPtr> out;
+
+    for (auto const& body : fetch_pages("/api/character", first, last)) {
+        auto decoded = decode_characters(body);
+        out.count = decoded.count;
+        out.pages = decoded.pages;
+        characters_upstream_count_ = decoded.count;
+
+        for (auto& c : decoded.results) {
+            out.results.push_back(store_character(std::move(c)));
         }
     }
     return out;
 }
 
-bool RickAndMortyApi::has_character_cached(int id) const {
-    return character_cache_.find(id) != character_cache_.end();
-}
+EpisodePtr RickAndMortyApi::get_episode(int id) {
+    if (auto cached = episode_cache_.find(id)) {
+        return cached;
+    }
 
-Episode RickAndMortyApi::get_episode(int id) {
-    const std::string host = "rickandmortyapi.com";
     const std::string target = "/api/episode/" + std::to_string(id);
 
-    auto body = client_.get(host, target);
-    auto obj  = json::parse(body).as_object();
+    auto page = decode_episodes(fetch(target));
+    if (page.results.size() != 1)
+        throw std::runtime_error("unexpected episode payload");
 
-    Episode ep;
-    ep.name     = std::string(obj.at("name").as_string().c_str());
-    ep.episode  = std::string(obj.at("episode").as_string().c_str());
-    ep.air_date = std::string(obj.at("air_date").as_string().c_str());
+    Episode ep = std::move(page.results.front());
 
-    for (auto const& u : obj.at("characters").as_array()) {
-        auto url  = std::string(u.as_string().c_str());
-        auto pos  = url.find_last_of('/');
-        int cid   = std::stoi(url.substr(pos + 1));
+    auto chars = get_characters(ep.character_ids);
+    std::sort(chars.begin(), chars.end(), [](auto const& a, auto const& b) {
+        return a->name.view() < b->name.view();
+    });
 
-        if (auto it = character_cache_.find(cid); it != character_cache_.end()) {
-            ep.characters.push_back(it->second.name);
-        } else {
-            ep.characters.push_back(get_character(cid).name);
-        }
+    ep.character_ids.clear();
+    for (auto const& c : chars) {
+        ep.character_ids.push_back(c->id);
     }
 
-    std::sort(ep.characters.begin(), ep.characters.end());
-    return ep;
+    return episode_cache_.assign(ep.id, std::move(ep));
 }
 
-std::string RickAndMortyApi::get_episode_all() {
-    const std::string upstream = "/api/episode";
-    return client_.get("rickandmortyapi.com", upstream);
+ResponseCache::Body RickAndMortyApi::get_episode_all() {
+    return aggregate_pages("episode");
 }
 
-std::string RickAndMortyApi::get_episode_single(int id) {
+ResponseCache::Body RickAndMortyApi::get_episode_single(int id) {
     const std::string upstream = "/api/episode/" + std::to_string(id);
-    return client_.get("rickandmortyapi.com", upstream);
+    return fetch_cached(upstream, kEntityTtl);
 }
 
-std::string RickAndMortyApi::get_episode_batch(const std::string& id_part) {
+ResponseCache::Body RickAndMortyApi::get_episode_batch(const std::string& id_part) {
     const std::string upstream = "/api/episode/" + id_part;
-    return client_.get("rickandmortyapi.com", upstream);
+    return fetch_cached(upstream, kEntityTtl);
 }
 
-std::string RickAndMortyApi::get_episode_query(const std::string& full_target) {
+ResponseCache::Body RickAndMortyApi::get_episode_query(const std::string& full_target) {
     const std::string upstream = "/api/episode";
-    return client_.get("rickandmortyapi.com", upstream + full_target);
+    return fetch_cached(upstream + full_target, kQueryTtl);
 }
 
-std::vector<std::pair<int, std::string>> RickAndMortyApi::get_all_characters_basic() {
-    const std::string host = "rickandmortyapi.com";
-    std::string target = "/api/character";
+std::vector<std::string> RickAndMortyApi::fetch_all_pages(const std::string& resource) {
+    const std::string target = "/api/" + resource;
 
-    std::vector<std::pair<int, std::string>> basic_list;
-    basic_list.reserve(826);
+    auto first = fetch(target);
+    int total = decode_page_info(first).pages;
 
-    while (!target.empty()) {
-        auto body = client_.get(host, target);
-        auto root = json::parse(body).as_object();
+    auto pages = fetch_pages(target, 2, total);
+    pages.insert(pages.begin(), std::move(first));
+    return pages;
+}
 
-        for (auto const& v : root.at("results").as_array()) {
-            auto obj = v.as_object();
-            int id = obj.at("id").as_int64();
-            std::string name = obj.at("name").as_string().c_str();
+std::vector<std::string> RickAndMortyApi::fetch_pages(const std::string& target, int first, int last) {
+    if (last < first)
+        return {};
 
-            basic_list.emplace_back(id, name);
+    std::vector<std::string> pages(last - first + 1);
 
-            if (!character_cache_.contains(id)) {
-                Character full = parse_character(obj);
-                character_cache_.emplace(id, std::move(full));
+    std::atomic<int> next{first};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&, deadline = current_deadline(), id = current_trace_id()]{
+        DeadlineScope scope(deadline);
+        TraceScope trace(id);
+        for (int page = next++; page <= last; page = next++) {
+            try {
+                pages[page - first] = fetch(target + "?page=" + std::to_string(page));
+            }
+            catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+                next = last + 1;
             }
         }
+    };
+
+    // Helpers that start after the caller drained every page return at once;
+    // the caller still waits for them since they reference this frame.
+    int helpers = background_work ? 0 : std::min<int>(kMaxPageFanout, pages.size()) - 1;
+    int running = helpers;
+    std::mutex done_mutex;
+    std::condition_variable done;
+    for (int i = 0; i < helpers; ++i) {
+        boost::asio::post(page_pool_, [&]{
+            worker();
+            std::lock_guard lock(done_mutex);
+            if (--running == 0)
+                done.notify_all();
+        });
+    }
+    worker();
+
+    std::unique_lock lock(done_mutex);
+    done.wait(lock, [&]{ return running == 0; });
 
-        auto const& info = root.at("info").as_object();
-        if (info.at("next").is_null()) {
-            target.clear();
-        } else {
-            std::string next = info.at("next").as_string().c_str();
-            auto pos = next.find("/api/character");
-            target = (pos == std::string::npos) ? "" : next.substr(pos);
+    if (error)
+        std::rethrow_exception(error);
+    return pages;
+}
+
+ResponseCache::Body RickAndMortyApi::aggregate_pages(const std::string& resource, bool bypass_cache) {
+    const std::string key = "/api/" + resource + "?all";
+    if (auto cached = response_cache_.get(key); cached && !bypass_cache) {
+        return cached;
+    }
+
+    auto build = [&]{
+        json::array results;
+        for (auto const& page : fetch_all_pages(resource)) {
+            Span span("json_parse");
+            auto root = json::parse(page);
+            for (auto const& v : root.as_object().at("results").as_array())
+                results.push_back(v);
+        }
+
+        json::object info;
+        info["count"] = results.size();
+        info["pages"] = 1;
+        info["next"]  = nullptr;
+        info["prev"]  = nullptr;
+
+        json::object out;
+        out["info"]    = std::move(info);
+        out["results"] = std::move(results);
+
+        auto body = json::serialize(out);
+        response_cache_.put(key, body, kAggregateTtl);
+        return body;
+    };
+
+    std::string body;
+    try {
+        body = in_flight_.run(key, build);
+    }
+    catch (...) {
+        if (upstream_unavailable(std::current_exception()))
+            if (auto stale = response_cache_.get_stale(key))
+                return stale;
+        throw;
+    }
+    return std::make_shared<const std::string>(std::move(body));
+}
+
+std::vector<CharacterPtr> RickAndMortyApi::get_all_characters() {
+    std::vector<CharacterPtr> all;
+    all.reserve(826);
+
+    if (characters_complete()) {
+        character_cache_.for_each([&](int, CharacterPtr const& c) { all.push_back(c); });
+    } else {
+        for (auto const& body : fetch_all_pages("character")) {
+            auto page = decode_characters(body);
+            characters_upstream_count_ = page.count;
+            for (auto& c : page.results) {
+                all.push_back(store_character(std::move(c)));
+            }
         }
     }
 
+    std::sort(all.begin(), all.end(),
+              [](auto const& a, auto const& b) { return a->id < b->id; });
+    return all;
+}
+
+std::vector<std::pair<int, std::string>> RickAndMortyApi::get_all_characters_basic() {
+    std::vector<std::pair<int, std::string>> basic_list;
+    basic_list.reserve(826);
+
+    for (auto const& c : get_all_characters()) {
+        basic_list.emplace_back(c->id, c->name.str());
+    }
     return basic_list;
 }
 
-std::vector<Character> RickAndMortyApi::get_characters_by_ids(const std::vector<int>& ids) {
+std::shared_ptr<const std::string> RickAndMortyApi::cached_all_characters_json() const {
+    std::lock_guard lock(all_characters_mutex_);
+    if (all_characters_json_ && all_characters_generation_ == characters_generation_.load())
+        return all_characters_json_;
+    return nullptr;
+}
+
+bool RickAndMortyApi::characters_complete() const {
+    int known = characters_upstream_count_.load();
+    return known > 0 && character_cache_.size() >= static_cast<std::size_t>(known);
+}
+
+std::shared_ptr<const std::string> RickAndMortyApi::get_all_characters_json() {
+    if (auto cached = cached_all_characters_json()) {
+        return cached;
+    }
+
+    // Read before the list: a character stored meanwhile then bumps the
+    // generation past this one and the body is rebuilt on the next call.
+    auto generation = characters_generation_.load();
+    auto all = get_all_characters();
+    auto body = std::make_shared<const std::string>(serialize_character_list(all));
+
+    std::lock_guard lock(all_characters_mutex_);
+    all_characters_json_ = body;
+    all_characters_generation_ = generation;
+    return body;
+}
+
+CharacterPtr RickAndMortyApi::store_character(Character c) {
+    if (auto cached = character_cache_.peek(c.id)) {
+        return cached;
+    }
+
+    c.serialized = serialize_character(c);
+    int id = c.id;
+    auto handle = character_cache_.insert(id, std::move(c));
+    ++characters_generation_;
+    return handle;
+}
+
+LocationPtr RickAndMortyApi::get_location(int id) {
+    if (auto cached = location_cache_.find(id)) {
+        return cached;
+    }
+
+    const std::string target = "/api/location/" + std::to_string(id);
+
+    auto page = decode_locations(fetch(target));
+    if (page.results.size() != 1)
+        throw std::runtime_error("unexpected location payload");
+
+    return store_locations(std::move(page.results)).front();
+}
+
+std::vector<LocationPtr> RickAndMortyApi::get_locations_by_ids(const std::vector<int>& ids) {
+    if (ids.empty()) return {};
+
+    std::string id_list = std::to_string(ids[0]);
+    for (size_t i = 1; i < ids.size(); ++i) {
+        id_list += "," + std::to_string(ids[i]);
+    }
+
+    const std::string target = "/api/location/" + id_list;
+    return store_locations(decode_locations(fetch(target)).results);
+}
+
+std::vector<LocationPtr> RickAndMortyApi::get_locations(const std::vector<int>& ids) {
+    std::unordered_map<int, LocationPtr> found;
+    std::vector<int> misses;
+
+    for (int id : ids) {
+        if (found.contains(id))
+            continue;
+        if (auto cached = location_cache_.find(id)) {
+            found.emplace(id, std::move(cached));
+        } else if (std::find(misses.begin(), misses.end(), id) == misses.end()) {
+            misses.push_back(id);
+        }
+    }
+
+    for (size_t i = 0; i < misses.size(); i += kMaxIdsPerRequest) {
+        auto last = misses.begin() + std::min(misses.size(), i + kMaxIdsPerRequest);
+        for (auto& l : get_locations_by_ids({misses.begin() + i, last})) {
+            found.emplace(l->id, std::move(l));
+        }
+    }
+
+    std::vector<LocationPtr> out;
+    out.reserve(ids.size());
+    for (int id : ids) {
+        if (auto it = found.find(id); it != found.end())
+            out.push_back(it->second);
+    }
+    return out;
+}
+
+std::vector<LocationPtr> RickAndMortyApi::get_all_locations() {
+    std::vector<LocationPtr> all;
+
+    int known = locations_upstream_count_.load();
+    if (known > 0 && location_cache_.size() >= static_cast<std::size_t>(known)) {
+        location_cache_.for_each([&](int, LocationPtr const& l) { all.push_back(l); });
+    } else {
+        std::vector<Location> fetched;
+        for (auto const& body : fetch_all_pages("location")) {
+            auto page = decode_locations(body);
+            locations_upstream_count_ = page.count;
+            std::move(page.results.begin(), page.results.end(), std::back_inserter(fetched));
+        }
+        all = store_locations(std::move(fetched));
+    }
+
+    std::sort(all.begin(), all.end(),
+              [](auto const& a, auto const& b) { return a->id < b->id; });
+    return all;
+}
+
+std::shared_ptr<const std::string> RickAndMortyApi::get_all_locations_json() {
+    {
+        std::lock_guard lock(all_locations_mutex_);
+        if (all_locations_json_ && all_locations_generation_ == locations_generation_.load())
+            return all_locations_json_;
+    }
+
+    // Read before the list, as for characters: a location stored meanwhile
+    // retires this body.
+    auto generation = locations_generation_.load();
+    auto all = get_all_locations();
+    auto body = std::make_shared<const std::string>(serialize_location_list(all));
+
+    std::lock_guard lock(all_locations_mutex_);
+    all_locations_json_ = body;
+    all_locations_generation_ = generation;
+    return body;
+}
+
+std::vector<LocationPtr> RickAndMortyApi::store_locations(std::vector<Location> locations) {
+    // Resolve every resident up front so misses go upstream in a few
+    // batched requests instead of one per location.
+    std::vector<int> resident_ids;
+    for (auto const& l : locations) {
+        if (!location_cache_.contains(l.id))
+            resident_ids.insert(resident_ids.end(), l.resident_ids.begin(), l.resident_ids.end());
+    }
+    get_characters(resident_ids);
+
+    std::vector<LocationPtr> out;
+    out.reserve(locations.size());
+
+    for (auto& l : locations) {
+        if (auto cached = location_cache_.peek(l.id)) {
+            out.push_back(std::move(cached));
+            continue;
+        }
+
+        auto residents = get_characters(l.resident_ids);
+        out.push_back(cache_location(std::move(l), std::move(residents)));
+    }
+    return out;
+}
+
+LocationPtr RickAndMortyApi::cache_location(Location l, std::vector<CharacterPtr> residents) {
+    std::sort(residents.begin(), residents.end(), [](auto const& a, auto const& b) {
+        return a->name.view() < b->name.view();
+    });
+
+    l.serialized = serialize_location(l, residents);
+    int id = l.id;
+    auto handle = location_cache_.insert(id, std::move(l));
+    ++locations_generation_;
+    return handle;
+}
+
+std::vector<CharacterPtr> RickAndMortyApi::get_characters_by_ids(const std::vector<int>& ids) {
     if (ids.empty()) return {};
 
     std::string id_list = std::to_string(ids[0]);
@@ -167,31 +559,196 @@ std::vector<Character> RickAndMortyApi::get_characters_by_ids(const std::vector<
         id_list += "," + std::to_string(ids[i]);
     }
 
-    const std::string host   = "rickandmortyapi.com";
     const std::string target = "/api/character/" + id_list;
 
-    auto body = client_.get(host, target);
-    json::value jv   = json::parse(body);
-    std::vector<Character> out;
-
-    if (jv.is_object()) {
-        auto obj = jv.as_object();
-        Character c = parse_character(obj);
-        character_cache_.try_emplace(c.id, c);
-        out.push_back(std::move(c));
-    }
-    else if (jv.is_array()) {
-        for (auto const& v : jv.as_array()) {
-            auto obj = v.as_object();
-            Character c = parse_character(obj);
-            character_cache_.try_emplace(c.id, c);
-            out.push_back(std::move(c));
+    auto page = decode_characters(fetch(target));
+    std::vector<CharacterPtr> out;
+    out.reserve(page.results.size());
+
+    for (auto& c : page.results) {
+        out.push_back(store_character(std::move(c)));
+    }
+    return out;
+}
+
+std::vector<CharacterPtr> RickAndMortyApi::get_characters(const std::vector<int>& ids) {
+    std::unordered_map<int, CharacterPtr> found;
+    std::vector<int> misses;
+
+    for (int id : ids) {
+        if (found.contains(id))
+            continue;
+        if (auto cached = character_cache_.find(id)) {
+            found.emplace(id, std::move(cached));
+        } else if (std::find(misses.begin(), misses.end(), id) == misses.end()) {
+            misses.push_back(id);
         }
     }
+
+    for (size_t i = 0; i < misses.size(); i += kMaxIdsPerRequest) {
+        auto last = misses.begin() + std::min(misses.size(), i + kMaxIdsPerRequest);
+        for (auto& c : get_characters_by_ids({misses.begin() + i, last})) {
+            found.emplace(c->id, std::move(c));
+        }
+    }
+
+    std::vector<CharacterPtr> out;
+    out.reserve(ids.size());
+    for (int id : ids) {
+        if (auto it = found.find(id); it != found.end())
+            out.push_back(it->second);
+    }
     return out;
 }
 
-std::string RickAndMortyApi::route_query(const std::string& target) {
-    const std::string host = "rickandmortyapi.com";
-    return client_.get(host, target);
+void RickAndMortyApi::warm_up() {
+    BackgroundScope background;
+    get_all_characters_json();
+    get_all_locations_json();
+    aggregate_pages("episode");
+}
+
+std::size_t RickAndMortyApi::refresh() {
+    BackgroundScope background;
+    auto info = decode_page_info(fetch("/api/character"));
+    characters_upstream_count_ = info.count;
+
+    // Upstream ids are dense, so anything up to info.count we have not seen
+    // yet is new.
+    std::vector<int> missing;
+    for (int id = 1; id <= info.count; ++id) {
+        if (!character_cache_.contains(id))
+            missing.push_back(id);
+    }
+
+    std::size_t added = get_characters(missing).size();
+    if (added > 0)
+        get_all_characters_json();
+
+    info = decode_page_info(fetch("/api/location"));
+    locations_upstream_count_ = info.count;
+
+    missing.clear();
+    for (int id = 1; id <= info.count; ++id) {
+        if (!location_cache_.contains(id))
+            missing.push_back(id);
+    }
+
+    std::size_t new_locations = get_locations(missing).size();
+    if (new_locations > 0)
+        get_all_locations_json();
+    added += new_locations;
+
+    const std::string key = "/api/episode?all";
+    int upstream = decode_page_info(fetch("/api/episode")).count;
+
+    auto cached = response_cache_.get(key);
+    int known = cached ? decode_page_info(*cached).count : 0;
+
+    if (cached && known == upstream) {
+        // Unchanged: extend the TTL so a client never finds it expired.
+        response_cache_.put(key, *cached, kAggregateTtl);
+    } else {
+        aggregate_pages("episode", true);
+        added += std::max(0, upstream - known);
+    }
+    return added;
+}
+
+ResponseCache::Body RickAndMortyApi::query_characters(const std::string& target) {
+    auto qpos = target.find('?');
+    if (qpos == std::string::npos || normalize_target(target.substr(0, qpos)) != "/api/character")
+        return nullptr;
+
+    auto query = parse_character_query(std::string_view(target).substr(qpos + 1));
+    if (!query)
+        return nullptr;
+
+    auto index = character_index();
+    if (!index)
+        return nullptr;
+
+    return std::make_shared<const std::string>(
+        serialize_character_page(index->match(*query), query->page, query->filters));
+}
+
+std::shared_ptr<const CharacterIndex> RickAndMortyApi::character_index() {
+    int known = characters_upstream_count_.load();
+    if (known == 0 || character_cache_.size() < static_cast<std::size_t>(known))
+        return nullptr;
+
+    std::lock_guard lock(character_index_mutex_);
+    auto generation = characters_generation_.load();
+    if (!character_index_ || character_index_generation_ != generation) {
+        std::vector<CharacterPtr> all;
+        all.reserve(known);
+        character_cache_.for_each([&](int, CharacterPtr const& c) { all.push_back(c); });
+
+        character_index_ = std::make_shared<const CharacterIndex>(std::move(all));
+        character_index_generation_ = generation;
+    }
+    return character_index_;
+}
+
+bool RickAndMortyApi::save_snapshot(const std::string& path) const {
+    std::vector<CharacterPtr> characters;
+    std::vector<EpisodePtr> episodes;
+    std::vector<LocationPtr> locations;
+    character_cache_.for_each([&](int, CharacterPtr const& c) { characters.push_back(c); });
+    episode_cache_.for_each([&](int, EpisodePtr const& ep) { episodes.push_back(ep); });
+    location_cache_.for_each([&](int, LocationPtr const& l) { locations.push_back(l); });
+
+    if (characters.empty() && episodes.empty() && locations.empty())
+        return false;
+    return write_snapshot(path, characters, episodes, locations, characters_upstream_count_.load());
+}
+
+std::size_t RickAndMortyApi::load_snapshot(const std::string& path, std::chrono::seconds max_age) {
+    auto snap = read_snapshot(path, max_age);
+    if (!snap)
+        return 0;
+
+    for (auto& c : snap->characters) {
+        store_character(std::move(c));
+    }
+    // A complete snapshot lets /character/all be served before warm_up();
+    // refresh() picks up anything added upstream since.
+    if (snap->character_upstream_count > 0 &&
+        character_cache_.size() >= static_cast<std::size_t>(snap->character_upstream_count)) {
+        int unknown = 0;
+        characters_upstream_count_.compare_exchange_strong(unknown, snap->character_upstream_count);
+    }
+    for (auto& ep : snap->episodes) {
+        int id = ep.id;
+        episode_cache_.insert(id, std::move(ep));
+    }
+    std::size_t loaded = snap->characters.size() + snap->episodes.size();
+
+    // Residents come from the cache only, so boot never waits on upstream; a
+    // location with an uncached resident is left for refresh() to fetch.
+    for (auto& l : snap->locations) {
+        std::vector<CharacterPtr> residents;
+        residents.reserve(l.resident_ids.size());
+        for (int id : l.resident_ids) {
+            auto c = character_cache_.peek(id);
+            if (!c)
+                break;
+            residents.push_back(std::move(c));
+        }
+        if (residents.size() != l.resident_ids.size())
+            continue;
+
+        cache_location(std::move(l), std::move(residents));
+        ++loaded;
+    }
+    return loaded;
+}
+
+ResponseCache::Body RickAndMortyApi::route_query(const std::string& target) {
+    if (auto local = query_characters(target)) {
+        return local;
+    }
+
+    bool is_query = target.find('?') != std::string::npos;
+    return fetch_cached(target, is_query ? kQueryTtl : kEntityTtl);
 }
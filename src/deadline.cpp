@@ -0,0 +1,24 @@
+#include "deadline.hpp"
+
+namespace {
+thread_local Deadline current = kNoDeadline;
+}
+
+DeadlineExceeded::DeadlineExceeded() : std::runtime_error("upstream did not answer in time") {}
+
+Deadline current_deadline() {
+    return current;
+}
+
+void check_deadline() {
+    if (current != kNoDeadline && Deadline::clock::now() >= current)
+        throw DeadlineExceeded();
+}
+
+DeadlineScope::DeadlineScope(Deadline deadline) : previous_(current) {
+    current = deadline;
+}
+
+DeadlineScope::~DeadlineScope() {
+    current = previous_;
+}
@@ -0,0 +1,309 @@
+#include "decoder.hpp"
+#include "trace.hpp"
+
+#include <boost/json/basic_parser_impl.hpp>
+
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace json = boost::json;
+
+namespace {
+
+// Per-model field mapping used by EntitySax. Unknown keys are ignored.
+void set_field(Character& c, std::string_view key, std::string_view v) {
+    if      (key == "name")    c.name    = v;
+    else if (key == "status")  c.status  = v;
+    else if (key == "species") c.species = v;
+    else if (key == "type")    c.type    = v;
+    else if (key == "gender")  c.gender  = v;
+    else if (key == "created") c.created = v;
+}
+
+void set_field(Character& c, std::string_view key, std::int64_t v) {
+    if (key == "id") c.id = static_cast<int>(v);
+}
+
+void set_nested(Character& c, std::string_view outer, std::string_view key, std::string_view v) {
+    if (key == "name") {
+        if      (outer == "origin")   c.origin_name   = v;
+        else if (outer == "location") c.location_name = v;
+    }
+    else if (key == "url") {
+        if      (outer == "origin")   c.origin_id   = url_id(v).value_or(0);
+        else if (outer == "location") c.location_id = url_id(v).value_or(0);
+    }
+}
+
+void add_element(Character& c, std::string_view key, std::string_view v) {
+    if (key == "episode") {
+        if (auto id = url_id(v)) c.episode_ids.push_back(*id);
+    }
+}
+
+void set_field(Episode& ep, std::string_view key, std::string_view v) {
+    if      (key == "name")     ep.name     = v;
+    else if (key == "episode")  ep.episode  = v;
+    else if (key == "air_date") ep.air_date = v;
+}
+
+void set_field(Episode& ep, std::string_view key, std::int64_t v) {
+    if (key == "id") ep.id = static_cast<int>(v);
+}
+
+void set_nested(Episode&, std::string_view, std::string_view, std::string_view) {}
+
+void add_element(Episode& ep, std::string_view key, std::string_view v) {
+    if (key == "characters") {
+        if (auto id = url_id(v)) ep.character_ids.push_back(*id);
+    }
+}
+
+void set_field(Location& l, std::string_view key, std::string_view v) {
+    if      (key == "name")      l.name      = v;
+    else if (key == "type")      l.type      = v;
+    else if (key == "dimension") l.dimension = v;
+    else if (key == "created")   l.created   = v;
+}
+
+void set_field(Location& l, std::string_view key, std::int64_t v) {
+    if (key == "id") l.id = static_cast<int>(v);
+}
+void set_nested(Location&, std::string_view, std::string_view, std::string_view) {}
+
+void add_element(Location& l, std::string_view key, std::string_view v) {
+    if (key == "residents") {
+        if (auto id = url_id(v)) l.resident_ids.push_back(*id);
+    }
+}
+
+// Only the envelope is of interest; entity fields are dropped.
+struct Ignored {};
+void set_field(Ignored&, std::string_view, std::string_view) {}
+void set_field(Ignored&, std::string_view, std::int64_t) {}
+void set_nested(Ignored&, std::string_view, std::string_view, std::string_view) {}
+void add_element(Ignored&, std::string_view, std::string_view) {}
+
+std::string_view sv(json::string_view s) {
+    return {s.data(), s.size()};
+}
+
+template<class Model>
+class EntitySax {
+public:
+    constexpr static std::size_t max_object_size = std::size_t(-1);
+    constexpr static std::size_t max_array_size  = std::size_t(-1);
+    constexpr static std::size_t max_key_size    = std::size_t(-1);
+    constexpr static std::size_t max_string_size = std::size_t(-1);
+
+    Page<Model> page;
+    std::string error;
+
+    EntitySax() { stack_.reserve(8); }
+
+    bool on_document_begin(json::error_code&) { return true; }
+    bool on_document_end(json::error_code&) { return true; }
+
+    bool on_object_begin(json::error_code&) {
+        if (stack_.empty()) {
+            push(Kind::Root);
+        } else {
+            auto& top = stack_.back();
+            if (top.kind == Kind::RootArray || top.kind == Kind::Results) {
+                current_ = Model{};
+                push(Kind::Entity);
+            }
+            else if (top.kind == Kind::Root && top.key == "info")
+                push(Kind::Info);
+            else if (top.kind == Kind::Root || top.kind == Kind::Entity)
+                push(Kind::Nested, top.key);
+            else
+                push(Kind::Skip);
+        }
+        return true;
+    }
+
+    bool on_object_end(std::size_t, json::error_code&) {
+        auto kind = stack_.back().kind;
+        stack_.pop_back();
+        if (kind == Kind::Entity || (kind == Kind::Root && root_is_entity_))
+            page.results.push_back(std::move(current_));
+        return true;
+    }
+
+    bool on_array_begin(json::error_code&) {
+        if (stack_.empty()) {
+            push(Kind::RootArray);
+        } else {
+            auto& top = stack_.back();
+            if (top.kind == Kind::Root && top.key == "results")
+                push(Kind::Results);
+            else if (top.kind == Kind::Root || top.kind == Kind::Entity)
+                push(Kind::List, top.key);
+            else
+                push(Kind::Skip);
+        }
+        return true;
+    }
+
+    bool on_array_end(std::size_t, json::error_code&) {
+        stack_.pop_back();
+        return true;
+    }
+
+    bool on_key_part(json::string_view s, std::size_t, json::error_code&) {
+        part_.append(s.data(), s.size());
+        return true;
+    }
+
+    bool on_key(json::string_view s, std::size_t, json::error_code&) {
+        stack_.back().key.assign(complete(s));
+        part_.clear();
+        return true;
+    }
+
+    bool on_string_part(json::string_view s, std::size_t, json::error_code&) {
+        part_.append(s.data(), s.size());
+        return true;
+    }
+
+    bool on_string(json::string_view s, std::size_t, json::error_code& ec) {
+        if (stack_.empty())
+            return scalar_document(ec);
+        std::string_view v = complete(s);
+        auto& top = stack_.back();
+        switch (top.kind) {
+        case Kind::Root:
+            if (top.key == "error") error.assign(v);
+            else set_field(current_, top.key, v);
+            break;
+        case Kind::Entity:
+            set_field(current_, top.key, v);
+            break;
+        case Kind::Nested:
+            set_nested(current_, top.outer, top.key, v);
+            break;
+        case Kind::List:
+            add_element(current_, top.outer, v);
+            break;
+        default:
+            break;
+        }
+        part_.clear();
+        return true;
+    }
+
+    bool on_int64(std::int64_t i, json::string_view, json::error_code& ec) {
+        if (stack_.empty())
+            return scalar_document(ec);
+        auto& top = stack_.back();
+        switch (top.kind) {
+        case Kind::Root:
+            if (top.key == "id") root_is_entity_ = true;
+            set_field(current_, top.key, i);
+            break;
+        case Kind::Entity:
+            set_field(current_, top.key, i);
+            break;
+        case Kind::Info:
+            if      (top.key == "count") page.count = static_cast<int>(i);
+            else if (top.key == "pages") page.pages = static_cast<int>(i);
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    bool on_uint64(std::uint64_t u, json::string_view s, json::error_code& ec) {
+        return on_int64(static_cast<std::int64_t>(u), s, ec);
+    }
+
+    bool on_number_part(json::string_view, json::error_code&) { return true; }
+    bool on_double(double, json::string_view, json::error_code&) { return true; }
+    bool on_bool(bool, json::error_code&) { return true; }
+    bool on_null(json::error_code&) { return true; }
+    bool on_comment_part(json::string_view, json::error_code&) { return true; }
+    bool on_comment(json::string_view, json::error_code&) { return true; }
+
+private:
+    enum class Kind { Root, RootArray, Info, Results, Entity, Nested, List, Skip };
+
+    struct Frame {
+        Kind kind;
+        std::string outer;
+        std::string key;
+    };
+
+    // A bare string or number is neither an entity nor a page.
+    bool scalar_document(json::error_code& ec) {
+        ec = json::error::not_object;
+        return false;
+    }
+
+    void push(Kind kind, std::string_view outer = {}) {
+        stack_.push_back({kind, std::string(outer), {}});
+    }
+
+    // Strings split across parser buffers arrive in parts; only then is a copy made.
+    std::string_view complete(json::string_view last) {
+        if (part_.empty())
+            return sv(last);
+        part_.append(last.data(), last.size());
+        return part_;
+    }
+
+    std::vector<Frame> stack_;
+    std::string part_;
+    Model current_{};
+    bool root_is_entity_ = false;
+};
+
+template<class Model>
+Page<Model> decode(std::string_view body) {
+    Span span("json_parse");
+    json::basic_parser<EntitySax<Model>> parser{json::parse_options{}};
+    json::error_code ec;
+    parser.write_some(false, body.data(), body.size(), ec);
+    if (ec)
+        throw std::runtime_error("malformed upstream JSON: " + ec.message());
+
+    auto& h = parser.handler();
+    if (!h.error.empty())
+        throw std::runtime_error(h.error);
+    return std::move(h.page);
+}
+}
+
+Page<Character> decode_characters(std::string_view body) {
+    return decode<Character>(body);
+}
+
+Page<Episode> decode_episodes(std::string_view body) {
+    return decode<Episode>(body);
+}
+
+Page<Location> decode_locations(std::string_view body) {
+    return decode<Location>(body);
+}
+
+PageInfo decode_page_info(std::string_view body) {
+    auto page = decode<Ignored>(body);
+    return {page.count, page.pages};
+}
+
+std::optional<int> url_id(std::string_view url) {
+    auto pos = url.find_last_of('/');
+    if (pos == std::string_view::npos)
+        return std::nullopt;
+
+    int id = 0;
+    auto first = url.data() + pos + 1;
+    auto last  = url.data() + url.size();
+    auto [ptr, ec] = std::from_chars(first, last, id);
+    if (ec != std::errc() || ptr != last || first == last)
+        return std::nullopt;
+    return id;
+}
@@ -1,241 +1,320 @@
 #include <algorithm>
-#include <thread>
 #include <chrono>
-#include <sstream>
+
+#include <boost/asio/redirect_error.hpp>
 
 #include "handler.hpp"
 #include "api.hpp"
+#include "metrics.hpp"
+#include "serialize.hpp"
 #include "utils.hpp"
 
 namespace beast = boost::beast;
 namespace http  = beast::http;
 namespace json  = boost::json;
 
-template<class F>
-auto with_retry(F&& f, int retries = 3) {
-    for (int i = 0; i < retries; ++i) {
-        try { return f(); }
-        catch (...) {
-            if (i == retries - 1) throw;
-            std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        }
+namespace {
+constexpr auto kIdleTimeout  = std::chrono::seconds(30);
+constexpr auto kWriteTimeout = std::chrono::seconds(30);
+constexpr auto kRequestBudget = std::chrono::seconds(15);
+constexpr int  kStreamPages  = 8;
+
+// Upstream outages are reported as such rather than as a bad request.
+http::status error_status(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    }
+    catch (CircuitOpenError const&) {
+        return http::status::service_unavailable;
+    }
+    catch (DeadlineExceeded const&) {
+        return http::status::gateway_timeout;
+    }
+    catch (...) {
+        return is_retryable(error) ? http::status::bad_gateway : http::status::bad_request;
     }
-    throw std::runtime_error("retry failed");
+}
 }
 
-Handler::Handler(beast::tcp_stream& stream, RickAndMortyApi& api)
-    : stream_(stream), api_(api) {}
+Handler::Handler(beast::tcp_stream stream, RickAndMortyApi& api, net::thread_pool& upstream)
+    : stream_(std::move(stream)), api_(api), upstream_(upstream) {}
+
+net::awaitable<void> Handler::handle() {
+    for (;;) {
+        http::request_parser<http::string_body> parser;
+        beast::error_code ec;
+
+        // Waiting for the header includes keep-alive idle time, so only the
+        // rest of the message counts as the request's read phase.
+        stream_.expires_after(kIdleTimeout);
+        co_await http::async_read_header(stream_, buffer_, parser, net::redirect_error(net::use_awaitable, ec));
+        trace_id_ = next_trace_id();
+        if (!ec) {
+            Span span("read", trace_id_);
+            co_await http::async_read(stream_, buffer_, parser, net::redirect_error(net::use_awaitable, ec));
+        }
+        auto req = parser.release();
 
-void Handler::handle() {
-    try {
-        beast::flat_buffer buffer;
-        http::request<http::string_body> req;
-        http::read(stream_, buffer, req);
+        if (ec == http::error::end_of_stream || ec == beast::error::timeout)
+            break;
 
-        std::string path(req.target());
-        route_request(path, req);
-    }
-    catch(std::exception const& e) {
-        json::object err{{"error", e.what()}};
-        http::response<http::string_body> res{http::status::bad_request, 11};
-        res.set(http::field::content_type, "application/json");
-        res.body() = json::serialize(err);
-        http::write(stream_, res);
+        if (ec) {
+            json::object err{{"error", ec.message()}};
+            send_response(http::status::bad_request, json::serialize(err), req);
+            res_.keep_alive(false);
+        }
+        else {
+            streamed_ = false;
+            deadline_ = std::chrono::steady_clock::now() + kRequestBudget;
+            try {
+                co_await route_request(std::string_view(req.target().data(), req.target().size()), req);
+            }
+            catch(std::exception const& e) {
+                // Headers already went out; closing is the only way to
+                // tell the client the chunked body is incomplete.
+                if (streamed_)
+                    break;
+                json::object err{{"error", e.what()}};
+                send_response(error_status(std::current_exception()), json::serialize(err), req);
+            }
+
+            if (streamed_) {
+                if (!req.keep_alive())
+                    break;
+                continue;
+            }
+            res_.keep_alive(req.keep_alive());
+        }
+
+        stream_.expires_after(kWriteTimeout);
+        {
+            Span span("write", trace_id_);
+            co_await http::async_write(stream_, res_, net::redirect_error(net::use_awaitable, ec));
+        }
+
+        if (ec || !res_.keep_alive())
+            break;
     }
-} 
 
-void Handler::send_response(http::status status, const std::string& body, const http::request<http::string_body>& req) {
-    http::response<http::string_body> res{status, req.version()};
-    res.set(http::field::content_type, "application/json");
-    res.body() = body;
-    res.prepare_payload();
-    http::write(stream_, res);
+    beast::error_code ec;
+    stream_.socket().shutdown(net::ip::tcp::socket::shutdown_send, ec);
 }
 
-void Handler::help(const http::request<http::string_body>& req) {
+void Handler::send_response(http::status status, ResponseCache::Body body, const http::request<http::string_body>& req) {
+    res_ = http::response<shared_string_body>{status, req.version()};
+    res_.set(http::field::content_type, "application/json");
+    res_.body() = std::move(body);
+    res_.prepare_payload();
+}
+
+void Handler::send_response(http::status status, std::string body, const http::request<http::string_body>& req) {
+    send_response(status, std::make_shared<const std::string>(std::move(body)), req);
+}
+
+net::awaitable<void> Handler::write_chunk(const std::string& data) {
+    Span span("write", trace_id_);
+    stream_.expires_after(kWriteTimeout);
+    co_await net::async_write(stream_, http::make_chunk(net::buffer(data)), net::use_awaitable);
+}
+
+net::awaitable<void> Handler::help(const http::request<http::string_body>& req) {
     json::object h;
     h["service"] = "RickAndMorty Middleware";
-    json::array cmds{"help", 
+    json::array cmds{"help", "metrics", "trace",
         "character/all", "character/id", "character/?key=value", "character/id1,id2",
         "location/all", "location/id", "location/?key=value", "location/id1,id2",
         "episode/all", "episode/id", "episode/?key=value", "episode/id1,id2"};
     h["commands"] = cmds;
     send_response(http::status::ok, json::serialize(h), req);
+    co_return;
 }
 
-void Handler::character_all(const http::request<http::string_body>& req) {
-    auto list = with_retry([&]{ return api_.get_all_characters_basic(); });
+net::awaitable<void> Handler::metrics_text(const http::request<http::string_body>& req) {
+    send_response(http::status::ok, metrics().render(), req);
+    res_.set(http::field::content_type, "text/plain; version=0.0.4");
+    co_return;
+}
 
-    json::array arr;
-    for (auto const& [id, name] : list) {
-        arr.push_back({{"id", id}, {"name", name}});
+net::awaitable<void> Handler::trace_dump(const http::request<http::string_body>& req) {
+    std::string_view target(req.target().data(), req.target().size());
+    if (auto q = target.find('?'); q != std::string_view::npos) {
+        for (auto const& [key, value] : parse_query(target.substr(q + 1))) {
+            if (key != "enable")
+                continue;
+            set_tracing(value == "1");
+            json::object out{{"tracing", tracing_enabled()}};
+            send_response(http::status::ok, json::serialize(out), req);
+            co_return;
+        }
     }
 
-    json::object out;
-    out["characters"] = arr;
-
-    send_response(http::status::ok, json::serialize(out), req);
+    send_response(http::status::ok, export_chrome_trace(), req);
 }
 
-void Handler::character_single(int id, const http::request<http::string_body>& req) {
-    auto c = with_retry([&]{ return api_.get_character(id); });
-
-    json::object o;
-    o["id"]       = c.id;
-    o["name"]     = c.name;
-    o["status"]   = c.status;
-    o["species"]  = c.species;
-    o["gender"]   = c.gender;
-    o["origin"]   = c.origin_name;
-    o["location"] = c.location_name;
+net::awaitable<void> Handler::character_all(const http::request<http::string_body>& req) {
+    if (auto cached = api_.cached_all_characters_json()) {
+        send_response(http::status::ok, std::move(cached), req);
+        co_return;
+    }
 
-    json::array eps;
-    for (int eid : c.episode_ids)
-        eps.push_back(eid);
+    // Streaming only pays off while pages still come from upstream; a complete
+    // cache is serialized in one go (and the body kept for the next client).
+    // HTTP/1.0 clients cannot receive chunked bodies.
+    if (req.version() >= 11 && !api_.characters_complete()) {
+        co_await character_all_streamed(req);
+        co_return;
+    }
 
-    o["episodes"] = eps;
+    auto body = co_await upstream_call([&]{ return api_.get_all_characters_json(); });
 
-    send_response(http::status::ok, json::serialize(o), req);
+    send_response(http::status::ok, std::move(body), req);
 }
 
-void Handler::character_batch(const std::string& id_part, const http::request<http::string_body>& req) {
-    for (char ch : id_part) {
-        if (!::isdigit(ch) && ch != ',') {
-            send_response(http::status::bad_request,
-                          R"({"error":"IDs must be numeric and comma-separated"})", req);
-            return;
-        }
+// Writes /character/all with chunked encoding, one chunk per group of
+// upstream pages, so the first bytes leave after a single round trip. The
+// chunks are not kept: once the stream has filled the character cache, the
+// cached body is serialized from it after the response is out, which costs
+// one more serialization but never holds a second copy while streaming.
+net::awaitable<void> Handler::character_all_streamed(const http::request<http::string_body>& req) {
+    auto first = co_await upstream_call([&]{ return api_.get_characters_pages(1, 1); });
+
+    http::response<http::empty_body> head{http::status::ok, req.version()};
+    head.set(http::field::content_type, "application/json");
+    head.keep_alive(req.keep_alive());
+    head.chunked(true);
+
+    http::response_serializer<http::empty_body> sr{head};
+    stream_.expires_after(kWriteTimeout);
+    co_await http::async_write_header(stream_, sr, net::use_awaitable);
+    streamed_ = true;
+
+    bool empty = first.results.empty();
+    co_await write_chunk(R"({"characters":[)" + serialize_character_entries(first.results));
+
+    for (int p = 2; p <= first.pages; p += kStreamPages) {
+        int last = std::min(first.pages, p + kStreamPages - 1);
+        auto page = co_await upstream_call([&]{ return api_.get_characters_pages(p, last); });
+        if (page.results.empty())
+            continue;
+
+        auto entries = serialize_character_entries(page.results);
+        if (!empty)
+            entries.insert(entries.begin(), ',');
+        empty = false;
+        co_await write_chunk(entries);
     }
 
-    std::vector<int> ids;
-    std::stringstream ss(id_part);
-    std::string tok;
-    while (std::getline(ss, tok, ',')) {
-        if (!tok.empty())
-            ids.push_back(std::stoi(tok));
-    }
+    co_await write_chunk("]}");
+    stream_.expires_after(kWriteTimeout);
+    co_await net::async_write(stream_, http::make_chunk_last(), net::use_awaitable);
 
-    json::array arr;
-    for (int cid : ids) {
-        Character c = api_.get_character(cid);
-        arr.push_back({{"id", c.id}, {"name", c.name}});
+    // Served from the cache alone now, so no upstream call is made.
+    if (api_.characters_complete())
+        co_await upstream_call([&]{ return api_.get_all_characters_json(); });
+}
+
+net::awaitable<void> Handler::character_single(int id, const http::request<http::string_body>& req) {
+    auto c = co_await upstream_call([&]{ return api_.get_character(id); });
+
+    send_response(http::status::ok, ResponseCache::Body(c, &c->serialized), req);
+}
+
+net::awaitable<void> Handler::character_batch(std::string_view id_part, const http::request<http::string_body>& req) {
+    std::vector<int> ids;
+    if (!parse_id_list(id_part, ids)) {
+        send_response(http::status::bad_request,
+                      R"({"error":"IDs must be numeric and comma-separated"})", req);
+        co_return;
     }
 
-    json::object out;
-    out["characters"] = arr;
+    auto chars = co_await upstream_call([&]{ return api_.get_characters(ids); });
 
-    send_response(http::status::ok, json::serialize(out), req);
+    send_response(http::status::ok, serialize_character_list(chars), req);
 }
 
-void Handler::character_query(const http::request<http::string_body>& req) {
+net::awaitable<void> Handler::character_query(std::string_view query, const http::request<http::string_body>& req) {
     try {
-        auto body = with_retry([&]{
-            return api_.route_query(std::string(req.target()));
-        });
+        const std::string forward_target = "/api/character/?" + std::string(query);
+
+        auto body = co_await upstream_call([&]{ return api_.route_query(forward_target); });
 
         send_response(http::status::ok, body, req);
     }
     catch (std::exception const& e) {
         json::object err{{"error", e.what()}};
-        send_response(http::status::bad_request, json::serialize(err), req);
+        send_response(error_status(std::current_exception()), json::serialize(err), req);
     }
 }
 
-void Handler::location_all(const http::request<http::string_body>& req) {
-    const std::string host = "rickandmortyapi.com";
-    const std::string target = "/api/location";
+net::awaitable<void> Handler::location_all(const http::request<http::string_body>& req) {
+    auto body = co_await upstream_call([&]{ return api_.get_all_locations_json(); });
 
-    auto body = with_retry([&]{ return api_.route_query(target); });
-
-    send_response(http::status::ok, body, req);
+    send_response(http::status::ok, std::move(body), req);
 }
 
-void Handler::location_single(int id, const http::request<http::string_body>& req) {
-    const std::string host = "rickandmortyapi.com";
-    const std::string target = "/api/location/" + std::to_string(id);
+net::awaitable<void> Handler::location_single(int id, const http::request<http::string_body>& req) {
+    auto l = co_await upstream_call([&]{ return api_.get_location(id); });
 
-    auto body = with_retry([&]{ return api_.route_query(target); });
-
-    send_response(http::status::ok, body, req);
+    send_response(http::status::ok, ResponseCache::Body(l, &l->serialized), req);
 }
 
-void Handler::location_batch(const std::string& id_part, const http::request<http::string_body>& req) {
-    for (char ch : id_part) {
-        if (!::isdigit(ch) && ch != ',') {
-            send_response(http::status::bad_request,
-                          R"({"error":"IDs must be numeric and comma-separated"})", req);
-            return;
-        }
-    }
-
+net::awaitable<void> Handler::location_batch(std::string_view id_part, const http::request<http::string_body>& req) {
     std::vector<int> ids;
-    std::stringstream ss(id_part);
-    std::string tok;
-    while (std::getline(ss, tok, ',')) {
-        if (!tok.empty())
-            ids.push_back(std::stoi(tok));
+    if (!parse_id_list(id_part, ids)) {
+        send_response(http::status::bad_request,
+                      R"({"error":"IDs must be numeric and comma-separated"})", req);
+        co_return;
     }
 
-    const std::string host = "rickandmortyapi.com";
-    const std::string upstream = "/api/location/";
+    auto locations = co_await upstream_call([&]{ return api_.get_locations(ids); });
 
-    std::string forward_target = upstream + id_part;
-
-    auto body = with_retry([&]{ return api_.route_query(forward_target); });
-
-    send_response(http::status::ok, body, req);
+    send_response(http::status::ok, serialize_location_list(locations), req);
 }
 
-void Handler::location_query(const http::request<http::string_body>& req) {
+net::awaitable<void> Handler::location_query(std::string_view query, const http::request<http::string_body>& req) {
     try {
-        const std::string upstream = "/api/location";
-        const std::string full_target = std::string(req.target());
+        const std::string forward_target = "/api/location/?" + std::string(query);
 
-        std::string forward_target = upstream + full_target;
-
-        auto body = with_retry([&]{ return api_.route_query(forward_target); });
+        auto body = co_await upstream_call([&]{ return api_.route_query(forward_target); });
 
         send_response(http::status::ok, body, req);
     }
     catch (std::exception const& e) {
         json::object err{{"error", e.what()}};
-        send_response(http::status::bad_request, json::serialize(err), req);
+        send_response(error_status(std::current_exception()), json::serialize(err), req);
     }
 }
 
-void Handler::episode_all(const http::request<http::string_body>& req) {
-    auto body = with_retry([&]{ return api_.get_episode_all(); });
+net::awaitable<void> Handler::episode_all(const http::request<http::string_body>& req) {
+    auto body = co_await upstream_call([&]{ return api_.get_episode_all(); });
     send_response(http::status::ok, body, req);
 }
 
-void Handler::episode_single(int id, const http::request<http::string_body>& req) {
-    auto body = with_retry([&]{ return api_.get_episode_single(id); });
+net::awaitable<void> Handler::episode_single(int id, const http::request<http::string_body>& req) {
+    auto body = co_await upstream_call([&]{ return api_.get_episode_single(id); });
     send_response(http::status::ok, body, req);
 }
 
-void Handler::episode_batch(const std::string& id_part, const http::request<http::string_body>& req) {
-    for (char ch : id_part) {
-        if (!::isdigit(ch) && ch != ',') {
-            send_response(http::status::bad_request,
-                          R"({"error":"IDs must be numeric and comma-separated"})", req);
-            return;
-        }
+net::awaitable<void> Handler::episode_batch(std::string_view id_part, const http::request<http::string_body>& req) {
+    std::vector<int> ids;
+    if (!parse_id_list(id_part, ids)) {
+        send_response(http::status::bad_request,
+                      R"({"error":"IDs must be numeric and comma-separated"})", req);
+        co_return;
     }
 
-    auto body = with_retry([&]{ return api_.get_episode_batch(id_part); });
+    auto body = co_await upstream_call([&]{ return api_.get_episode_batch(std::string(id_part)); });
     send_response(http::status::ok, body, req);
 }
 
-void Handler::episode_query(const http::request<http::string_body>& req) {
+net::awaitable<void> Handler::episode_query(std::string_view query, const http::request<http::string_body>& req) {
     try {
-        auto body = with_retry([&]{ 
-            return api_.get_episode_query(std::string(req.target()).substr(8));
-        });
+        auto body = co_await upstream_call([&]{ return api_.get_episode_query("/?" + std::string(query)); });
         send_response(http::status::ok, body, req);
     }
     catch (std::exception const& e) {
         json::object err{{"error", e.what()}};
-        send_response(http::status::bad_request, json::serialize(err), req);
+        send_response(error_status(std::current_exception()), json::serialize(err), req);
     }
 }
 
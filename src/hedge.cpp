@@ -0,0 +1,45 @@
+#include "hedge.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+constexpr auto kDefaultDelay       = std::chrono::milliseconds(100);
+constexpr auto kMinDelay           = std::chrono::milliseconds(5);
+constexpr std::size_t kMinSamples  = 32;
+constexpr std::size_t kRecomputeEvery = 16;
+constexpr double kMaxTokens        = 10;
+}
+
+HedgePolicy::HedgePolicy(double budget, double quantile)
+    : delay_(kDefaultDelay), budget_(budget), quantile_(quantile) {}
+
+HedgePolicy::Duration HedgePolicy::delay() const {
+    std::lock_guard lock(mutex_);
+    return delay_;
+}
+
+void HedgePolicy::record(Duration latency) {
+    std::lock_guard lock(mutex_);
+    samples_[recorded_++ % kWindow] = latency;
+    if (recorded_ < kMinSamples || recorded_ % kRecomputeEvery != 0)
+        return;
+
+    std::vector<Duration> window(samples_.begin(), samples_.begin() + std::min(recorded_, kWindow));
+    auto nth = window.begin() + static_cast<std::size_t>(quantile_ * (window.size() - 1));
+    std::nth_element(window.begin(), nth, window.end());
+    delay_ = std::max<Duration>(*nth, kMinDelay);
+}
+
+void HedgePolicy::on_request() {
+    std::lock_guard lock(mutex_);
+    tokens_ = std::min(kMaxTokens, tokens_ + budget_);
+}
+
+bool HedgePolicy::try_acquire() {
+    std::lock_guard lock(mutex_);
+    if (tokens_ < 1)
+        return false;
+    tokens_ -= 1;
+    return true;
+}
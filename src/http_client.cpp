@@ -4,44 +4,273 @@
 #include <boost/beast/ssl.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
+#include <openssl/ssl.h>
 
 #include "http_client.hpp"
+#include "deadline.hpp"
+#include "metrics.hpp"
+#include "retry.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-HttpClient::HttpClient(bool verbose) : verbose_(verbose) {}
+namespace beast = boost::beast;
+namespace http  = beast::http;
+namespace net   = boost::asio;
+namespace ssl   = net::ssl;
 
-std::string HttpClient::get(const std::string& host, const std::string& target) {
-    namespace beast = boost::beast;
-    namespace http  = beast::http;
-    namespace net   = boost::asio;
-    namespace ssl   = net::ssl;
+namespace {
+constexpr auto kDnsTtl              = std::chrono::minutes(5);
+constexpr auto kIdleTimeout         = std::chrono::seconds(30);
+constexpr auto kIoTimeout           = std::chrono::seconds(10);
+constexpr auto kShutdownTimeout     = std::chrono::seconds(1);
+constexpr std::size_t kMaxIdlePerHost = 16;
+
+using Stream = ssl::stream<beast::tcp_stream>;
+
+// One TLS stream with a private io_context. Calls stay synchronous for the
+// caller, but every step runs as an async operation on that context so the
+// tcp_stream expiry can cancel a stalled connect, handshake or read.
+struct Upstream {
+    net::io_context ioc{1};
+    Stream stream;
+
+    explicit Upstream(ssl::context& ctx) : stream(ioc, ctx) {}
+
+    beast::tcp_stream& tcp() { return beast::get_lowest_layer(stream); }
+
+    template<class Initiate>
+    beast::error_code run(Initiate&& initiate) {
+        beast::error_code result;
+        initiate([&result](beast::error_code ec, auto&&...) { result = ec; });
+        ioc.restart();
+        ioc.run();
+        return result;
+    }
+
+    // An expiry caused by the request deadline is reported as such; one
+    // caused by kIoTimeout stays a (retryable) network error.
+    template<class Initiate>
+    void run_or_throw(Initiate&& initiate) {
+        auto ec = run(std::forward<Initiate>(initiate));
+        if (ec == beast::error::timeout)
+            check_deadline();
+        if (ec)
+            throw boost::system::system_error(ec);
+    }
+};
+
+// "host" or "host:port"; the port defaults to 443.
+std::pair<std::string, std::string> split_host(const std::string& host) {
+    auto colon = host.rfind(':');
+    if (colon == std::string::npos)
+        return {host, "443"};
+    return {host.substr(0, colon), host.substr(colon + 1)};
+}
+
+Deadline io_deadline() {
+    return std::min<Deadline>(current_deadline(), std::chrono::steady_clock::now() + kIoTimeout);
+}
+
+void exchange(Upstream& up, const http::request<http::empty_body>& req, http::response<http::string_body>& res) {
+    up.tcp().expires_at(io_deadline());
+    {
+        Span span("upstream_write");
+        up.run_or_throw([&](auto handler) { http::async_write(up.stream, req, handler); });
+    }
+    beast::flat_buffer buffer;
+    {
+        Span span("upstream_read");
+        up.run_or_throw([&](auto handler) { http::async_read(up.stream, buffer, res, handler); });
+    }
+    up.tcp().expires_never();
+}
+}
+
+// Keeps TLS streams to each upstream host alive between calls. The shared
+// io_context only serves the synchronous resolver.
+struct HttpClient::Pool {
+    using Clock = std::chrono::steady_clock;
+
+    struct Connection {
+        std::unique_ptr<Upstream> upstream;
+        Clock::time_point idle_since;
+    };
+
+    struct Resolved {
+        net::ip::tcp::resolver::results_type results;
+        Clock::time_point expires;
+    };
 
     net::io_context ioc;
-    ssl::context ctx(ssl::context::tlsv12_client);
-    ctx.set_default_verify_paths();
+    ssl::context ctx{ssl::context::tlsv12_client};
+    std::mutex mutex;
+    std::unordered_map<std::string, Resolved> dns;
+    std::unordered_map<std::string, SSL_SESSION*> sessions;
+    std::unordered_map<std::string, std::vector<Connection>> idle;
+    std::unordered_map<std::string, CircuitBreaker> breakers;
+
+    Pool() {
+        ctx.set_default_verify_paths();
+        SSL_CTX_set_session_cache_mode(ctx.native_handle(), SSL_SESS_CACHE_CLIENT);
+    }
 
-    net::ip::tcp::resolver resolver(ioc);
-    auto const results = resolver.resolve(host, "443");
+    ~Pool() {
+        idle.clear();
+        for (auto& [host, session] : sessions)
+            SSL_SESSION_free(session);
+    }
 
-    ssl::stream<beast::tcp_stream> stream(ioc, ctx);
-    beast::get_lowest_layer(stream).connect(results);
-    stream.handshake(ssl::stream_base::client);
+    std::unique_ptr<Upstream> acquire(const std::string& host) {
+        std::lock_guard lock(mutex);
+        auto& conns = idle[host];
+        while (!conns.empty()) {
+            auto conn = std::move(conns.back());
+            conns.pop_back();
+            if (Clock::now() - conn.idle_since < kIdleTimeout)
+                return std::move(conn.upstream);
+        }
+        return nullptr;
+    }
+
+    void release(const std::string& host, std::unique_ptr<Upstream> upstream) {
+        std::lock_guard lock(mutex);
+        auto& conns = idle[host];
+        if (conns.size() < kMaxIdlePerHost)
+            conns.push_back({std::move(upstream), Clock::now()});
+    }
 
+    net::ip::tcp::resolver::results_type resolve(const std::string& host) {
+        Span span("dns");
+        {
+            std::lock_guard lock(mutex);
+            if (auto it = dns.find(host); it != dns.end() && Clock::now() < it->second.expires)
+                return it->second.results;
+        }
+
+        auto [name, port] = split_host(host);
+        net::ip::tcp::resolver resolver(ioc);
+        auto results = resolver.resolve(name, port);
+
+        std::lock_guard lock(mutex);
+        dns[host] = {results, Clock::now() + kDnsTtl};
+        return results;
+    }
+
+    std::unique_ptr<Upstream> connect(const std::string& host) {
+        auto results = resolve(host);
+
+        auto up = std::make_unique<Upstream>(ctx);
+        SSL_set_tlsext_host_name(up->stream.native_handle(), split_host(host).first.c_str());
+        {
+            std::lock_guard lock(mutex);
+            if (auto it = sessions.find(host); it != sessions.end())
+                SSL_set_session(up->stream.native_handle(), it->second);
+        }
+
+        up->tcp().expires_at(io_deadline());
+        {
+            Span span("connect");
+            up->run_or_throw([&](auto handler) { up->tcp().async_connect(results, handler); });
+        }
+        {
+            Span span("tls_handshake");
+            up->run_or_throw([&](auto handler) { up->stream.async_handshake(ssl::stream_base::client, handler); });
+        }
+        up->tcp().expires_never();
+        return up;
+    }
+
+    CircuitBreaker& breaker(const std::string& host) {
+        std::lock_guard lock(mutex);
+        return breakers.try_emplace(host).first->second;
+    }
+
+    void remember_session(const std::string& host, Stream& stream) {
+        SSL_SESSION* session = SSL_get1_session(stream.native_handle());
+        if (!session)
+            return;
+
+        std::lock_guard lock(mutex);
+        auto& slot = sessions[host];
+        if (slot)
+            SSL_SESSION_free(slot);
+        slot = session;
+    }
+};
+
+HttpClient::HttpClient(bool verbose) : verbose_(verbose), pool_(std::make_unique<Pool>()) {}
+
+HttpClient::~HttpClient() = default;
+
+std::string HttpClient::get(const std::string& host, const std::string& target) {
+    check_deadline();
+    auto& breaker = pool_->breaker(host);
+    if (!breaker.allow())
+        throw CircuitOpenError(host);
+
+    auto& stats = metrics().upstream(target);
+    ScopedTimer timer(stats.latency);
+    try {
+        auto body = perform(host, target);
+        breaker.on_success();
+        return body;
+    }
+    catch (DeadlineExceeded const&) {
+        // The request ran out of budget; that says nothing about upstream.
+        breaker.on_abandoned();
+        throw;
+    }
+    catch (...) {
+        stats.errors.add();
+        breaker.on_failure();
+        throw;
+    }
+}
+
+std::string HttpClient::perform(const std::string& host, const std::string& target) {
     http::request<http::empty_body> req{http::verb::get, target, 11};
     req.set(http::field::host, host);
     req.set(http::field::user_agent, "Boost.Beast Client");
+    req.keep_alive(true);
 
-    http::write(stream, req);
+    auto up = pool_->acquire(host);
+    bool reused = up != nullptr;
+    if (!reused)
+        up = pool_->connect(host);
 
-    beast::flat_buffer buffer;
     http::response<http::string_body> res;
-    http::read(stream, buffer, res);
+    try {
+        exchange(*up, req, res);
+    }
+    catch (boost::system::system_error const&) {
+        if (!reused) throw;
+        // upstream may have dropped the idle connection; retry once on a fresh one
+        up = pool_->connect(host);
+        res = {};
+        exchange(*up, req, res);
+    }
 
-    beast::error_code ec;
-    stream.shutdown(ec);
+    pool_->remember_session(host, up->stream);
+    if (res.keep_alive()) {
+        pool_->release(host, std::move(up));
+    } else {
+        up->tcp().expires_after(kShutdownTimeout);
+        up->run([&](auto handler) { up->stream.async_shutdown(handler); });
+    }
 
     if (verbose_) {
-        std::cout << "[HTTP GET] " << host << target << "\n";
+        std::cout << "[HTTP GET] " << host << target << (reused ? " (reused)" : "") << "\n";
     }
-    return res.body();
+
+    auto status = res.result_int();
+    if (status == 429 || status >= 500)
+        throw UpstreamError(status);
+    return std::move(res.body());
 }
@@ -0,0 +1,149 @@
+#include "metrics.hpp"
+#include "symbol.hpp"
+
+#include <cstdio>
+#include <utility>
+
+namespace {
+constexpr std::array<std::string_view, Metrics::kShapes> kShapeNames{
+    "not_found", "index", "all", "single", "batch", "query",
+};
+
+std::string_view resource_name(std::size_t resource) {
+    return route_detail::kResources[resource].name;
+}
+
+// Upstream targets outside the known resources are filed under Help.
+std::string_view upstream_name(std::size_t resource) {
+    return resource == static_cast<std::size_t>(Resource::Help) ? "other" : resource_name(resource);
+}
+
+void append_seconds(std::string& out, std::uint64_t us) {
+    char buf[32];
+    int n = std::snprintf(buf, sizeof buf, "%g", static_cast<double>(us) / 1e6);
+    out.append(buf, n);
+}
+
+void append_header(std::string& out, std::string_view name, std::string_view type, std::string_view help) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void append_counter(std::string& out, std::string_view name, std::string_view labels, std::uint64_t value) {
+    out.append(name);
+    if (!labels.empty())
+        out.append("{").append(labels).append("}");
+    out.append(" ").append(std::to_string(value)).append("\n");
+}
+
+void append_histogram(std::string& out, std::string_view name, std::string_view labels, const Histogram::Totals& t) {
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < t.buckets.size(); ++i) {
+        cumulative += t.buckets[i];
+        out.append(name).append("_bucket{").append(labels).append(",le=\"");
+        if (i < Histogram::kBounds.size())
+            append_seconds(out, Histogram::kBounds[i]);
+        else
+            out.append("+Inf");
+        out.append("\"} ").append(std::to_string(cumulative)).append("\n");
+    }
+    out.append(name).append("_sum{").append(labels).append("} ");
+    append_seconds(out, t.sum_us);
+    out.append("\n");
+    out.append(name).append("_count{").append(labels).append("} ").append(std::to_string(t.count)).append("\n");
+}
+
+std::string label(std::string_view key, std::string_view value) {
+    std::string out(key);
+    out.append("=\"").append(value).append("\"");
+    return out;
+}
+}
+
+std::uint64_t Counter::value() const {
+    std::uint64_t total = 0;
+    for (auto const& slot : slots_)
+        total += slot.value.load(std::memory_order_relaxed);
+    return total;
+}
+
+Histogram::Totals Histogram::totals() const {
+    Totals t;
+    for (auto const& slot : slots_) {
+        for (std::size_t i = 0; i < t.buckets.size(); ++i)
+            t.buckets[i] += slot.buckets[i].load(std::memory_order_relaxed);
+        t.sum_us += slot.sum_us.load(std::memory_order_relaxed);
+    }
+    for (auto n : t.buckets)
+        t.count += n;
+    return t;
+}
+
+UpstreamStats& Metrics::upstream(std::string_view target) {
+    // "/api/character/1,2" -> "character"
+    if (target.starts_with("/api/"))
+        target.remove_prefix(5);
+    auto segment = target.substr(0, target.find_first_of("/?"));
+    auto resource = find_resource(segment).value_or(Resource::Help);
+    return upstream_[static_cast<std::size_t>(resource)];
+}
+
+std::string Metrics::render() const {
+    std::string out;
+    out.reserve(16 * 1024);
+
+    append_header(out, "http_request_duration_seconds", "histogram", "Time spent routing and answering a request.");
+    for (std::size_t r = 0; r < kResources; ++r) {
+        for (std::size_t s = 0; s < kShapes; ++s) {
+            auto t = requests_[r * kShapes + s].totals();
+            if (t.count == 0)
+                continue;
+            append_histogram(out, "http_request_duration_seconds",
+                             label("resource", resource_name(r)) + "," + label("shape", kShapeNames[s]), t);
+        }
+    }
+
+    append_header(out, "upstream_request_duration_seconds", "histogram", "Latency of calls to the upstream API.");
+    for (std::size_t r = 0; r < kResources; ++r) {
+        auto t = upstream_[r].latency.totals();
+        if (t.count != 0)
+            append_histogram(out, "upstream_request_duration_seconds", label("resource", upstream_name(r)), t);
+    }
+
+    append_header(out, "upstream_errors_total", "counter", "Upstream calls that failed or returned 429/5xx.");
+    for (std::size_t r = 0; r < kResources; ++r) {
+        if (auto n = upstream_[r].errors.value())
+            append_counter(out, "upstream_errors_total", label("resource", upstream_name(r)), n);
+    }
+
+    append_header(out, "upstream_retries_total", "counter", "Upstream attempts repeated after a transient failure.");
+    append_counter(out, "upstream_retries_total", {}, retries.value());
+
+    const std::pair<std::string_view, const CacheStats*> caches[] = {
+        {"character", &characters}, {"episode", &episodes}, {"location", &locations}, {"response", &responses},
+    };
+    append_header(out, "cache_hits_total", "counter", "Cache lookups answered from memory.");
+    for (auto [name, stats] : caches)
+        append_counter(out, "cache_hits_total", label("cache", name), stats->hits.value());
+    append_header(out, "cache_misses_total", "counter", "Cache lookups that had to go upstream.");
+    for (auto [name, stats] : caches)
+        append_counter(out, "cache_misses_total", label("cache", name), stats->misses.value());
+    append_header(out, "cache_evictions_total", "counter", "Entries dropped to respect a cache's size budget.");
+    for (auto [name, stats] : caches)
+        append_counter(out, "cache_evictions_total", label("cache", name), stats->evictions.value());
+    append_header(out, "cache_entry_bytes", "gauge", "Bytes held by cached entities outside the symbol arena.");
+    for (auto [name, stats] : caches) {
+        if (stats != &responses)
+            append_counter(out, "cache_entry_bytes", label("cache", name), stats->bytes.value());
+    }
+
+    append_header(out, "symbol_arena_bytes", "gauge", "Bytes of interned model text, shared by all entities.");
+    append_counter(out, "symbol_arena_bytes", {}, symbol_arena_bytes());
+
+    return out;
+}
+
+Metrics& metrics() {
+    static Metrics instance;
+    return instance;
+}
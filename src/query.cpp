@@ -0,0 +1,131 @@
+#include "query.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <iterator>
+
+#include "utils.hpp"
+
+namespace {
+constexpr std::size_t kTrigram = 3;
+
+std::string lower(std::string_view s) {
+    std::string out(s);
+    for (char& c : out)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return out;
+}
+}
+
+std::optional<CharacterQuery> parse_character_query(std::string_view query) {
+    CharacterQuery q;
+
+    for (auto& [key, value] : parse_query(query)) {
+        if      (key == "name")    q.name    = std::move(value);
+        else if (key == "status")  q.status  = std::move(value);
+        else if (key == "species") q.species = std::move(value);
+        else if (key == "type")    q.type    = std::move(value);
+        else if (key == "gender")  q.gender  = std::move(value);
+        else if (key == "page") {
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), q.page);
+            if (ec != std::errc() || ptr != value.data() + value.size() || q.page < 1)
+                return std::nullopt;
+        }
+        else return std::nullopt;
+    }
+
+    while (!query.empty()) {
+        auto end = query.find('&');
+        auto param = query.substr(0, end);
+        query = end == std::string_view::npos ? std::string_view{} : query.substr(end + 1);
+        if (param.empty() || param.starts_with("page="))
+            continue;
+        if (!q.filters.empty())
+            q.filters += '&';
+        q.filters += param;
+    }
+    return q;
+}
+
+CharacterIndex::CharacterIndex(std::vector<CharacterPtr> characters)
+    : characters_(std::move(characters)) {
+    std::sort(characters_.begin(), characters_.end(),
+              [](auto const& a, auto const& b) { return a->id < b->id; });
+
+    names_.reserve(characters_.size());
+    for (std::uint32_t i = 0; i < characters_.size(); ++i) {
+        auto const& c = *characters_[i];
+        status_[lower(c.status.view())].push_back(i);
+        species_[lower(c.species.view())].push_back(i);
+        type_[lower(c.type.view())].push_back(i);
+        gender_[lower(c.gender.view())].push_back(i);
+
+        auto const& name = names_.emplace_back(lower(c.name.view()));
+        for (std::size_t k = 0; k + kTrigram <= name.size(); ++k) {
+            auto& postings = name_trigrams_[name.substr(k, kTrigram)];
+            if (postings.empty() || postings.back() != i)
+                postings.push_back(i);
+        }
+    }
+}
+
+std::vector<CharacterPtr> CharacterIndex::match(const CharacterQuery& q) const {
+    // Unset means "every character"; each filter narrows it by intersection.
+    std::optional<Postings> result;
+    auto narrow = [&](Postings postings) {
+        if (!result) {
+            result = std::move(postings);
+            return;
+        }
+        Postings both;
+        std::set_intersection(result->begin(), result->end(), postings.begin(), postings.end(),
+                              std::back_inserter(both));
+        result = std::move(both);
+    };
+
+    auto exact = [](const ValueIndex& index, const std::string& value) {
+        auto it = index.find(lower(value));
+        return it == index.end() ? Postings{} : it->second;
+    };
+
+    auto containing = [](const ValueIndex& index, const std::string& value) {
+        auto needle = lower(value);
+        Postings out;
+        for (auto const& [key, postings] : index) {
+            if (key.find(needle) != std::string::npos)
+                out.insert(out.end(), postings.begin(), postings.end());
+        }
+        std::sort(out.begin(), out.end());
+        return out;
+    };
+
+    if (q.status)  narrow(exact(status_, *q.status));
+    if (q.gender)  narrow(exact(gender_, *q.gender));
+    if (q.species) narrow(containing(species_, *q.species));
+    if (q.type)    narrow(containing(type_, *q.type));
+
+    std::string needle;
+    if (q.name) {
+        needle = lower(*q.name);
+        for (std::size_t k = 0; k + kTrigram <= needle.size() && (!result || !result->empty()); ++k) {
+            auto it = name_trigrams_.find(needle.substr(k, kTrigram));
+            narrow(it == name_trigrams_.end() ? Postings{} : it->second);
+        }
+    }
+
+    std::vector<CharacterPtr> out;
+    auto take = [&](std::uint32_t i) {
+        // Trigrams only prove the pieces are present; confirm the substring.
+        if (q.name && names_[i].find(needle) == std::string::npos)
+            return;
+        out.push_back(characters_[i]);
+    };
+
+    if (result) {
+        for (auto i : *result) take(i);
+    } else {
+        for (std::uint32_t i = 0; i < characters_.size(); ++i) take(i);
+    }
+    return out;
+}
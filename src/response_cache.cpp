@@ -0,0 +1,70 @@
+#include "response_cache.hpp"
+#include "trace.hpp"
+
+namespace {
+std::size_t footprint(const std::string& key, const std::string& body) {
+    return key.size() + body.size();
+}
+}
+
+ResponseCache::ResponseCache(std::size_t max_bytes, CacheStats* stats) : max_bytes_(max_bytes), stats_(stats) {}
+
+ResponseCache::Body ResponseCache::get(const std::string& key) {
+    Span span("cache_lookup");
+    std::lock_guard lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end() || Clock::now() >= it->second->expires) {
+        if (stats_) stats_->misses.add();
+        return nullptr;
+    }
+
+    if (stats_) stats_->hits.add();
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->body;
+}
+
+ResponseCache::Body ResponseCache::get_stale(const std::string& key) {
+    std::lock_guard lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end())
+        return nullptr;
+    return it->second->body;
+}
+
+ResponseCache::Body ResponseCache::put(const std::string& key, std::string body, std::chrono::seconds ttl) {
+    auto shared = std::make_shared<const std::string>(std::move(body));
+    std::size_t size = footprint(key, *shared);
+    if (size > max_bytes_)
+        return shared;
+
+    std::lock_guard lock(mutex_);
+    if (auto it = index_.find(key); it != index_.end())
+        erase_locked(it->second);
+
+    lru_.push_front({key, shared, Clock::now() + ttl});
+    index_.emplace(key, lru_.begin());
+    bytes_ += size;
+
+    while (bytes_ > max_bytes_) {
+        erase_locked(std::prev(lru_.end()));
+        if (stats_) stats_->evictions.add();
+    }
+
+    return shared;
+}
+
+std::size_t ResponseCache::bytes() const {
+    std::lock_guard lock(mutex_);
+    return bytes_;
+}
+
+std::size_t ResponseCache::size() const {
+    std::lock_guard lock(mutex_);
+    return lru_.size();
+}
+
+void ResponseCache::erase_locked(std::list<Entry>::iterator it) {
+    bytes_ -= footprint(it->key, *it->body);
+    index_.erase(it->key);
+    lru_.erase(it);
+}
@@ -0,0 +1,87 @@
+#include "retry.hpp"
+
+#include <algorithm>
+#include <random>
+
+#include <boost/system/system_error.hpp>
+
+UpstreamError::UpstreamError(int status)
+    : std::runtime_error("upstream returned HTTP " + std::to_string(status)), status_(status) {}
+
+CircuitOpenError::CircuitOpenError(const std::string& host)
+    : std::runtime_error("upstream " + host + " is unavailable") {}
+
+CircuitBreaker::CircuitBreaker(int threshold, Clock::duration cooldown)
+    : threshold_(threshold), cooldown_(cooldown) {}
+
+bool CircuitBreaker::allow() {
+    std::lock_guard lock(mutex_);
+    switch (state_) {
+    case State::Closed:
+        return true;
+    case State::Open:
+        if (Clock::now() - opened_at_ < cooldown_)
+            return false;
+        state_ = State::HalfOpen;
+        return true;
+    case State::HalfOpen:
+        return false;
+    }
+    return false;
+}
+
+void CircuitBreaker::on_success() {
+    std::lock_guard lock(mutex_);
+    state_ = State::Closed;
+    failures_ = 0;
+}
+
+void CircuitBreaker::on_failure() {
+    std::lock_guard lock(mutex_);
+    if (state_ == State::HalfOpen || ++failures_ >= threshold_) {
+        state_ = State::Open;
+        opened_at_ = Clock::now();
+    }
+}
+
+void CircuitBreaker::on_abandoned() {
+    std::lock_guard lock(mutex_);
+    // The cooldown has already elapsed, so the next allow() probes again.
+    if (state_ == State::HalfOpen)
+        state_ = State::Open;
+}
+
+bool CircuitBreaker::open() const {
+    std::lock_guard lock(mutex_);
+    return state_ != State::Closed;
+}
+
+bool is_retryable(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    }
+    catch (CircuitOpenError const&) {
+        return false;
+    }
+    catch (UpstreamError const& e) {
+        return e.status() == 429 || e.status() >= 500;
+    }
+    catch (boost::system::system_error const&) {
+        return true;
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+std::chrono::milliseconds backoff_delay(const RetryPolicy& policy, int attempt) {
+    thread_local std::mt19937 rng{std::random_device{}()};
+
+    auto ceiling = policy.base.count() << std::min(attempt - 1, 20);
+    ceiling = std::min<long long>(ceiling, policy.cap.count());
+    if (ceiling <= 0)
+        return std::chrono::milliseconds(0);
+
+    std::uniform_int_distribution<long long> jitter(0, ceiling - 1);
+    return std::chrono::milliseconds(jitter(rng));
+}
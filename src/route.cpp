@@ -0,0 +1,74 @@
+#include "route.hpp"
+
+#include <algorithm>
+#include <charconv>
+
+namespace {
+bool parse_id(std::string_view s, int& id) {
+    if (s.empty() || s.front() < '0' || s.front() > '9')
+        return false;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), id);
+    return ec == std::errc() && ptr == s.data() + s.size();
+}
+}
+
+Route match_route(std::string_view target) {
+    Route route;
+
+    auto qpos = target.find('?');
+    auto path = target.substr(0, qpos);
+    if (qpos != std::string_view::npos)
+        route.query = target.substr(qpos + 1);
+
+    if (!path.starts_with('/'))
+        return route;
+    path.remove_prefix(1);
+
+    auto slash = path.find('/');
+    auto resource = find_resource(path.substr(0, slash));
+    if (!resource)
+        return route;
+
+    route.resource = *resource;
+    auto rest = slash == std::string_view::npos ? std::string_view{} : path.substr(slash + 1);
+
+    if (route.resource == Resource::Help || route.resource == Resource::Metrics || route.resource == Resource::Trace) {
+        if (slash == std::string_view::npos)
+            route.shape = Shape::Index;
+        return route;
+    }
+
+    if (rest.empty()) {
+        if (qpos != std::string_view::npos)
+            route.shape = Shape::Query;
+    }
+    else if (rest == "all") {
+        route.shape = Shape::All;
+    }
+    else if (parse_id(rest, route.id)) {
+        route.shape = Shape::Single;
+    }
+    else if (rest.find(',') != std::string_view::npos) {
+        route.shape = Shape::Batch;
+        route.ids = rest;
+    }
+    return route;
+}
+
+bool parse_id_list(std::string_view list, std::vector<int>& ids) {
+    ids.reserve(ids.size() + std::count(list.begin(), list.end(), ',') + 1);
+
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto item = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+        if (item.empty())
+            continue;
+
+        int id = 0;
+        if (!parse_id(item, id))
+            return false;
+        ids.push_back(id);
+    }
+    return true;
+}
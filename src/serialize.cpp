@@ -0,0 +1,148 @@
+#include "serialize.hpp"
+#include "trace.hpp"
+
+#include <boost/json.hpp>
+#include <algorithm>
+
+namespace json = boost::json;
+
+namespace {
+constexpr int kUpstreamPageSize = 20;
+constexpr std::string_view kUpstream = "https://rickandmortyapi.com/api/";
+
+std::string resource_url(std::string_view resource, int id) {
+    if (id == 0)
+        return {};
+    return std::string(kUpstream) + std::string(resource) + "/" + std::to_string(id);
+}
+
+json::object place(Symbol name, int id) {
+    json::object o;
+    o["name"] = name.view();
+    o["url"]  = resource_url("location", id);
+    return o;
+}
+
+json::object upstream_character(const Character& c) {
+    json::object o;
+    o["id"]       = c.id;
+    o["name"]     = c.name.view();
+    o["status"]   = c.status.view();
+    o["species"]  = c.species.view();
+    o["type"]     = c.type.view();
+    o["gender"]   = c.gender.view();
+    o["origin"]   = place(c.origin_name, c.origin_id);
+    o["location"] = place(c.location_name, c.location_id);
+    o["image"]    = resource_url("character/avatar", c.id) + ".jpeg";
+
+    json::array eps;
+    for (int eid : c.episode_ids)
+        eps.emplace_back(std::string_view(resource_url("episode", eid)));
+
+    o["episode"]  = std::move(eps);
+    o["url"]      = resource_url("character", c.id);
+    o["created"]  = c.created.view();
+    return o;
+}
+
+json::value page_url(int page, std::string_view filters) {
+    std::string url = std::string(kUpstream) + "character/?page=" + std::to_string(page);
+    if (!filters.empty()) {
+        url += '&';
+        url += filters;
+    }
+    return json::value(std::string_view(url));
+}
+}
+
+std::string serialize_character(const Character& c) {
+    Span span("serialize");
+    json::object o;
+    o["id"]       = c.id;
+    o["name"]     = c.name.view();
+    o["status"]   = c.status.view();
+    o["species"]  = c.species.view();
+    o["gender"]   = c.gender.view();
+    o["origin"]   = c.origin_name.view();
+    o["location"] = c.location_name.view();
+
+    json::array eps;
+    for (int eid : c.episode_ids)
+        eps.push_back(eid);
+
+    o["episodes"] = eps;
+    return json::serialize(o);
+}
+
+std::string serialize_character_entries(const std::vector<CharacterPtr>& characters) {
+    Span span("serialize");
+    std::string out;
+    for (auto const& c : characters) {
+        if (!out.empty())
+            out += ',';
+        out += json::serialize(json::object{{"id", c->id}, {"name", c->name.view()}});
+    }
+    return out;
+}
+
+std::string serialize_character_list(const std::vector<CharacterPtr>& characters) {
+    return R"({"characters":[)" + serialize_character_entries(characters) + "]}";
+}
+
+std::string serialize_location(const Location& l, const std::vector<CharacterPtr>& residents) {
+    Span span("serialize");
+    json::object o;
+    o["id"]        = l.id;
+    o["name"]      = l.name.view();
+    o["type"]      = l.type.view();
+    o["dimension"] = l.dimension.view();
+
+    json::array arr;
+    arr.reserve(residents.size());
+    for (auto const& c : residents) {
+        arr.push_back({{"id", c->id}, {"name", c->name.view()}});
+    }
+
+    o["residents"] = std::move(arr);
+    return json::serialize(o);
+}
+
+std::string serialize_location_list(const std::vector<LocationPtr>& locations) {
+    Span span("serialize");
+    json::array arr;
+    arr.reserve(locations.size());
+    for (auto const& l : locations) {
+        arr.push_back({{"id", l->id}, {"name", l->name.view()},
+                       {"type", l->type.view()}, {"dimension", l->dimension.view()}});
+    }
+
+    json::object out;
+    out["locations"] = std::move(arr);
+    return json::serialize(out);
+}
+
+std::string serialize_character_page(const std::vector<CharacterPtr>& matches, int page,
+                                     std::string_view filters) {
+    Span span("serialize");
+    int count = static_cast<int>(matches.size());
+    int pages = (count + kUpstreamPageSize - 1) / kUpstreamPageSize;
+    if (page < 1 || page > pages)
+        return R"({"error":"There is nothing here"})";
+
+    json::object info;
+    info["count"] = count;
+    info["pages"] = pages;
+    info["next"]  = page < pages ? page_url(page + 1, filters) : json::value(nullptr);
+    info["prev"]  = page > 1 ? page_url(page - 1, filters) : json::value(nullptr);
+
+    json::array results;
+    int first = (page - 1) * kUpstreamPageSize;
+    int last  = std::min(count, first + kUpstreamPageSize);
+    for (int i = first; i < last; ++i)
+        results.push_back(upstream_character(*matches[i]));
+
+    json::object out;
+    out["info"]    = std::move(info);
+    out["results"] = std::move(results);
+    return json::serialize(out);
+}
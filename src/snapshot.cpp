@@ -0,0 +1,266 @@
+#include "snapshot.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+constexpr char kMagic[8] = {'R', 'M', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr std::uint32_t kVersion = 5;
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::int64_t created;
+    std::uint64_t checksum;
+    std::uint64_t payload_size;
+    std::uint32_t character_count;
+    std::uint32_t episode_count;
+    std::uint32_t location_count;
+    std::uint32_t reserved2;
+};
+
+std::uint64_t fnv1a(const char* data, std::size_t size) {
+    std::uint64_t h = 1469598103934665603ull;
+    for (std::size_t i = 0; i < size; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+class Writer {
+public:
+    template<class T>
+    void pod(T v) { out_.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+
+    void str(std::string_view s) {
+        pod<std::uint32_t>(s.size());
+        out_.append(s);
+    }
+
+    const std::string& bytes() const { return out_; }
+
+private:
+    std::string out_;
+};
+
+class Reader {
+public:
+    Reader(const char* data, std::size_t size) : cur_(data), end_(data + size) {}
+
+    template<class T>
+    T pod() {
+        T v;
+        need(sizeof(v));
+        std::memcpy(&v, cur_, sizeof(v));
+        cur_ += sizeof(v);
+        return v;
+    }
+
+    std::string_view str() {
+        auto n = pod<std::uint32_t>();
+        need(n);
+        std::string_view s(cur_, n);
+        cur_ += n;
+        return s;
+    }
+
+private:
+    void need(std::size_t n) {
+        if (static_cast<std::size_t>(end_ - cur_) < n)
+            throw std::runtime_error("snapshot truncated");
+    }
+
+    const char* cur_;
+    const char* end_;
+};
+
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                data_ = static_cast<const char*>(p);
+                size_ = st.st_size;
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data_)
+            ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+}
+
+bool write_snapshot(const std::string& path,
+                    const std::vector<CharacterPtr>& characters,
+                    const std::vector<EpisodePtr>& episodes,
+                    const std::vector<LocationPtr>& locations,
+                    int character_upstream_count) {
+    Writer w;
+    w.pod<std::int32_t>(character_upstream_count);
+    for (auto const& c : characters) {
+        w.pod<std::int32_t>(c->id);
+        w.str(c->name);
+        w.str(c->status);
+        w.str(c->species);
+        w.str(c->type);
+        w.str(c->gender);
+        w.str(c->origin_name);
+        w.str(c->location_name);
+        w.pod<std::int32_t>(c->origin_id);
+        w.pod<std::int32_t>(c->location_id);
+        w.pod<std::uint32_t>(c->episode_ids.size());
+        for (int eid : c->episode_ids)
+            w.pod<std::int32_t>(eid);
+        w.str(c->created);
+    }
+    for (auto const& ep : episodes) {
+        w.pod<std::int32_t>(ep->id);
+        w.str(ep->name);
+        w.str(ep->episode);
+        w.str(ep->air_date);
+        w.pod<std::uint32_t>(ep->character_ids.size());
+        for (int cid : ep->character_ids)
+            w.pod<std::int32_t>(cid);
+    }
+    for (auto const& l : locations) {
+        w.pod<std::int32_t>(l->id);
+        w.str(l->name);
+        w.str(l->type);
+        w.str(l->dimension);
+        w.pod<std::uint32_t>(l->resident_ids.size());
+        for (int cid : l->resident_ids)
+            w.pod<std::int32_t>(cid);
+        w.str(l->created);
+    }
+
+    Header h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version         = kVersion;
+    h.created         = std::chrono::duration_cast<std::chrono::seconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count();
+    h.checksum        = fnv1a(w.bytes().data(), w.bytes().size());
+    h.payload_size    = w.bytes().size();
+    h.character_count = characters.size();
+    h.episode_count   = episodes.size();
+    h.location_count  = locations.size();
+
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(w.bytes().data(), w.bytes().size());
+        if (!out)
+            return false;
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+std::optional<Snapshot> read_snapshot(const std::string& path, std::chrono::seconds max_age) {
+    MappedFile file(path);
+    if (!file.data() || file.size() < sizeof(Header))
+        return std::nullopt;
+
+    Header h;
+    std::memcpy(&h, file.data(), sizeof(h));
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion)
+        return std::nullopt;
+    if (h.payload_size != file.size() - sizeof(Header))
+        return std::nullopt;
+
+    const char* payload = file.data() + sizeof(Header);
+    if (fnv1a(payload, h.payload_size) != h.checksum)
+        return std::nullopt;
+
+    Snapshot snap;
+    snap.created = std::chrono::system_clock::time_point(std::chrono::seconds(h.created));
+    if (std::chrono::system_clock::now() - snap.created > max_age)
+        return std::nullopt;
+
+    try {
+        Reader r(payload, h.payload_size);
+        snap.character_upstream_count = r.pod<std::int32_t>();
+
+        snap.characters.reserve(h.character_count);
+        for (std::uint32_t i = 0; i < h.character_count; ++i) {
+            Character c;
+            c.id            = r.pod<std::int32_t>();
+            c.name          = r.str();
+            c.status        = r.str();
+            c.species       = r.str();
+            c.type          = r.str();
+            c.gender        = r.str();
+            c.origin_name   = r.str();
+            c.location_name = r.str();
+            c.origin_id     = r.pod<std::int32_t>();
+            c.location_id   = r.pod<std::int32_t>();
+            auto n = r.pod<std::uint32_t>();
+            c.episode_ids.reserve(n);
+            for (std::uint32_t j = 0; j < n; ++j)
+                c.episode_ids.push_back(r.pod<std::int32_t>());
+            c.created       = r.str();
+            snap.characters.push_back(std::move(c));
+        }
+
+        snap.episodes.reserve(h.episode_count);
+        for (std::uint32_t i = 0; i < h.episode_count; ++i) {
+            Episode ep;
+            ep.id       = r.pod<std::int32_t>();
+            ep.name     = r.str();
+            ep.episode  = r.str();
+            ep.air_date = r.str();
+            auto n = r.pod<std::uint32_t>();
+            ep.character_ids.reserve(n);
+            for (std::uint32_t j = 0; j < n; ++j)
+                ep.character_ids.push_back(r.pod<std::int32_t>());
+            snap.episodes.push_back(std::move(ep));
+        }
+
+        snap.locations.reserve(h.location_count);
+        for (std::uint32_t i = 0; i < h.location_count; ++i) {
+            Location l;
+            l.id        = r.pod<std::int32_t>();
+            l.name      = r.str();
+            l.type      = r.str();
+            l.dimension = r.str();
+            auto n = r.pod<std::uint32_t>();
+            l.resident_ids.reserve(n);
+            for (std::uint32_t j = 0; j < n; ++j)
+                l.resident_ids.push_back(r.pod<std::int32_t>());
+            l.created   = r.str();
+            snap.locations.push_back(std::move(l));
+        }
+    }
+    catch (std::exception const&) {
+        return std::nullopt;
+    }
+    return snap;
+}
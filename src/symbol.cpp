@@ -0,0 +1,79 @@
+#include "symbol.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+constexpr std::size_t kBlockSize = 64 * 1024;
+
+// Strings are packed back to back into large blocks that are never freed or
+// moved, which keeps the views handed out by Symbol valid for the process.
+class SymbolTable {
+public:
+    std::string_view intern(std::string_view s) {
+        {
+            std::shared_lock lock(mutex_);
+            if (auto it = index_.find(s); it != index_.end())
+                return *it;
+        }
+
+        std::unique_lock lock(mutex_);
+        if (auto it = index_.find(s); it != index_.end())
+            return *it;
+
+        std::string_view stored = store(s);
+        index_.insert(stored);
+        return stored;
+    }
+
+    std::size_t bytes() const {
+        std::shared_lock lock(mutex_);
+        return used_;
+    }
+
+private:
+    std::string_view store(std::string_view s) {
+        if (capacity_ - offset_ < s.size()) {
+            capacity_ = std::max(kBlockSize, s.size());
+            blocks_.push_back(std::make_unique<char[]>(capacity_));
+            offset_ = 0;
+        }
+
+        char* dst = blocks_.back().get() + offset_;
+        std::memcpy(dst, s.data(), s.size());
+        offset_ += s.size();
+        used_   += s.size();
+        return {dst, s.size()};
+    }
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_set<std::string_view> index_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    std::size_t capacity_ = 0;
+    std::size_t offset_ = 0;
+    std::size_t used_ = 0;
+};
+
+SymbolTable& table() {
+    static SymbolTable t;
+    return t;
+}
+}
+
+Symbol::Symbol(std::string_view s) {
+    if (s.empty())
+        return;
+
+    auto stored = table().intern(s);
+    data_ = stored.data();
+    size_ = static_cast<std::uint32_t>(stored.size());
+}
+
+std::size_t symbol_arena_bytes() {
+    return table().bytes();
+}
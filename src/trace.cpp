@@ -0,0 +1,165 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+constexpr std::size_t kRingCapacity = 2048;
+
+// One slot of a ring, guarded by a sequence number: odd while the owning
+// thread writes it, so readers can drop torn copies instead of locking.
+struct Event {
+    std::atomic<std::uint64_t> seq{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<std::uint64_t> request{0};
+    std::atomic<std::int64_t> start_us{0};
+    std::atomic<std::int64_t> dur_us{0};
+};
+
+struct Ring {
+    std::array<Event, kRingCapacity> events;
+    std::atomic<std::uint64_t> head{0};
+    std::size_t index = 0;
+
+    void push(const char* name, std::uint64_t request, std::int64_t start, std::int64_t dur) {
+        auto h = head.load(std::memory_order_relaxed);
+        auto& e = events[h % kRingCapacity];
+        e.seq.store(2 * h + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        e.name.store(name, std::memory_order_relaxed);
+        e.request.store(request, std::memory_order_relaxed);
+        e.start_us.store(start, std::memory_order_relaxed);
+        e.dur_us.store(dur, std::memory_order_relaxed);
+        e.seq.store(2 * h + 2, std::memory_order_release);
+        head.store(h + 1, std::memory_order_release);
+    }
+};
+
+// Rings outlive their threads so short-lived fan-out threads neither lose
+// their spans nor grow memory: a ring goes back to the free list on thread
+// exit and the next new thread reuses it.
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::vector<Ring*> free;
+
+    Ring* acquire() {
+        std::lock_guard lock(mutex);
+        if (!free.empty()) {
+            auto ring = free.back();
+            free.pop_back();
+            return ring;
+        }
+        rings.push_back(std::make_unique<Ring>());
+        rings.back()->index = rings.size() - 1;
+        return rings.back().get();
+    }
+
+    void release(Ring* ring) {
+        std::lock_guard lock(mutex);
+        free.push_back(ring);
+    }
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+struct Lease {
+    Ring* ring = nullptr;
+    ~Lease() {
+        if (ring)
+            registry().release(ring);
+    }
+};
+
+thread_local Lease lease;
+thread_local std::uint64_t current_id = 0;
+
+Ring& local_ring() {
+    if (!lease.ring)
+        lease.ring = registry().acquire();
+    return *lease.ring;
+}
+
+struct Copy {
+    const char* name;
+    std::uint64_t request;
+    std::int64_t start_us;
+    std::int64_t dur_us;
+    std::size_t thread;
+};
+}
+
+void set_tracing(bool on) {
+    trace_detail::enabled.store(on, std::memory_order_relaxed);
+}
+
+std::int64_t trace_now_us() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+std::uint64_t current_trace_id() {
+    return current_id;
+}
+
+std::uint64_t next_trace_id() {
+    static std::atomic<std::uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+TraceScope::TraceScope(std::uint64_t id) : previous_(current_id) {
+    current_id = id;
+}
+
+TraceScope::~TraceScope() {
+    current_id = previous_;
+}
+
+void Span::finish() {
+    local_ring().push(name_, request_, start_us_, trace_now_us() - start_us_);
+}
+
+std::string export_chrome_trace() {
+    std::vector<Copy> events;
+    {
+        auto& reg = registry();
+        std::lock_guard lock(reg.mutex);
+        for (auto const& ring : reg.rings) {
+            for (auto const& e : ring->events) {
+                auto before = e.seq.load(std::memory_order_acquire);
+                if (before == 0 || before % 2 == 1)
+                    continue;
+                Copy c{e.name.load(std::memory_order_relaxed), e.request.load(std::memory_order_relaxed),
+                       e.start_us.load(std::memory_order_relaxed), e.dur_us.load(std::memory_order_relaxed),
+                       ring->index};
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (e.seq.load(std::memory_order_relaxed) == before)
+                    events.push_back(c);
+            }
+        }
+    }
+    std::sort(events.begin(), events.end(), [](auto const& a, auto const& b) { return a.start_us < b.start_us; });
+
+    std::string out;
+    out.reserve(events.size() * 96 + 64);
+    out += R"({"displayTimeUnit":"ms","traceEvents":[)";
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        auto const& e = events[i];
+        if (i) out += ',';
+        out += R"({"name":")";
+        out += e.name;
+        out += R"(","ph":"X","pid":1,"tid":)" + std::to_string(e.request);
+        out += R"(,"ts":)" + std::to_string(e.start_us);
+        out += R"(,"dur":)" + std::to_string(e.dur_us);
+        out += R"(,"args":{"thread":)" + std::to_string(e.thread) + "}}";
+    }
+    out += "]}";
+    return out;
+}
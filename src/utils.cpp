@@ -1,5 +1,8 @@
 #include "utils.hpp"
 
+#include <algorithm>
+#include <vector>
+
 std::pair<std::string, std::string> parse_https_url(const std::string& url) {
     const std::string https = "https://";
     auto host_start = https.size();
@@ -8,3 +11,79 @@ std::pair<std::string, std::string> parse_https_url(const std::string& url) {
     std::string target = url.substr(path_start);
     return {host, target};
 }
+
+
+std::string normalize_target(const std::string& target) {
+    auto qpos = target.find('?');
+    std::string path = target.substr(0, qpos);
+    while (path.size() > 1 && path.back() == '/')
+        path.pop_back();
+
+    if (qpos == std::string::npos)
+        return path;
+
+    std::vector<std::string> params;
+    std::string query = target.substr(qpos + 1);
+    size_t start = 0;
+    while (start <= query.size()) {
+        auto end = query.find('&', start);
+        if (end == std::string::npos) end = query.size();
+        if (end > start)
+            params.push_back(query.substr(start, end - start));
+        start = end + 1;
+    }
+
+    if (params.empty())
+        return path;
+
+    std::sort(params.begin(), params.end());
+    path += '?';
+    for (size_t i = 0; i < params.size(); ++i) {
+        if (i) path += '&';
+        path += params[i];
+    }
+    return path;
+}
+
+namespace {
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+std::string url_decode(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '+') {
+            out += ' ';
+        } else if (s[i] == '%' && i + 2 < s.size() && hex_value(s[i + 1]) >= 0 && hex_value(s[i + 2]) >= 0) {
+            out += static_cast<char>(hex_value(s[i + 1]) * 16 + hex_value(s[i + 2]));
+            i += 2;
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+}
+
+std::vector<std::pair<std::string, std::string>> parse_query(std::string_view query) {
+    std::vector<std::pair<std::string, std::string>> params;
+    while (!query.empty()) {
+        auto end = query.find('&');
+        auto param = query.substr(0, end);
+        query = end == std::string_view::npos ? std::string_view{} : query.substr(end + 1);
+        if (param.empty())
+            continue;
+
+        auto eq = param.find('=');
+        if (eq == std::string_view::npos)
+            params.emplace_back(url_decode(param), std::string{});
+        else
+            params.emplace_back(url_decode(param.substr(0, eq)), url_decode(param.substr(eq + 1)));
+    }
+    return params;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "http_client.hpp"
+#include "retry.hpp"
+
+// Stands in for rickandmortyapi.com so API and handler tests run offline.
+// Serves `characters` dense character ids in pages of 20, the episodes and
+// locations it is given, and empty location/episode lists; records every
+// target it was asked for.
+class FakeUpstream : public HttpClient {
+public:
+    static constexpr int kPageSize = 20;
+
+    explicit FakeUpstream(int characters = 45) : characters_(characters) {}
+
+    std::map<int, std::vector<int>> episodes;   // id -> character ids
+    std::map<int, std::vector<int>> locations;  // id -> resident ids
+    std::chrono::milliseconds delay{0};         // added to every call
+    std::atomic<int> fail_page{0};              // character page answering 503
+
+    std::string get(const std::string&, const std::string& target) override {
+        {
+            std::lock_guard lock(mutex_);
+            targets_.push_back(target);
+            max_in_flight_ = std::max(max_in_flight_, ++in_flight_);
+        }
+        std::this_thread::sleep_for(delay);
+        {
+            std::lock_guard lock(mutex_);
+            --in_flight_;
+        }
+        return respond(target);
+    }
+
+    std::vector<std::string> targets() const {
+        std::lock_guard lock(mutex_);
+        return targets_;
+    }
+
+    int max_in_flight() const {
+        std::lock_guard lock(mutex_);
+        return max_in_flight_;
+    }
+
+    void clear() {
+        std::lock_guard lock(mutex_);
+        targets_.clear();
+        max_in_flight_ = 0;
+    }
+
+    static std::string character(int id) {
+        auto n = std::to_string(id);
+        return R"({"id":)" + n + R"(,"name":"Character )" + n +
+               R"(","status":"Alive","species":"Human","type":"","gender":"Male",)"
+               R"("origin":{"name":"Earth","url":"https://rickandmortyapi.com/api/location/1"},)"
+               R"("location":{"name":"Earth","url":"https://rickandmortyapi.com/api/location/1"},)"
+               R"("episode":["https://rickandmortyapi.com/api/episode/1"],)"
+               R"("url":"https://rickandmortyapi.com/api/character/)" + n +
+               R"(","created":"2017-11-04T18:48:46.250Z"})";
+    }
+
+private:
+    static std::string urls(std::string_view resource, const std::vector<int>& ids) {
+        std::string out = "[";
+        for (std::size_t i = 0; i < ids.size(); ++i) {
+            if (i) out += ',';
+            out += "\"https://rickandmortyapi.com/api/" + std::string(resource) + "/" + std::to_string(ids[i]) + "\"";
+        }
+        return out + "]";
+    }
+
+    std::string episode(int id) const {
+        return R"({"id":)" + std::to_string(id) + R"(,"name":"Episode )" + std::to_string(id) +
+               R"(","air_date":"December 2, 2013","episode":"S01E01","characters":)" +
+               urls("character", episodes.at(id)) + "}";
+    }
+
+    std::string location(int id) const {
+        return R"({"id":)" + std::to_string(id) + R"(,"name":"Location )" + std::to_string(id) +
+               R"(","type":"Planet","dimension":"unknown","residents":)" + urls("character", locations.at(id)) +
+               R"(,"created":"2017-11-10T12:42:04.162Z"})";
+    }
+
+    std::string page(int number) const {
+        int pages = std::max(1, (characters_ + kPageSize - 1) / kPageSize);
+        std::string results;
+        for (int id = (number - 1) * kPageSize + 1; id <= std::min(characters_, number * kPageSize); ++id) {
+            if (!results.empty()) results += ',';
+            results += character(id);
+        }
+        return R"({"info":{"count":)" + std::to_string(characters_) + R"(,"pages":)" + std::to_string(pages) +
+               R"(,"next":null,"prev":null},"results":[)" + results + "]}";
+    }
+
+    // "/api/character/1,2" -> entities 1 and 2, as an array when several ids
+    // were asked for, as upstream does.
+    template<class Known, class Render>
+    static std::string entities(std::string_view ids, Known known, Render render) {
+        std::vector<std::string> found;
+        bool many = ids.find(',') != std::string_view::npos;
+        while (!ids.empty()) {
+            auto comma = ids.find(',');
+            int id = std::stoi(std::string(ids.substr(0, comma)));
+            if (known(id))
+                found.push_back(render(id));
+            ids = comma == std::string_view::npos ? std::string_view{} : ids.substr(comma + 1);
+        }
+        if (!many)
+            return found.empty() ? R"({"error":"not found"})" : found.front();
+        std::string out = "[";
+        for (std::size_t i = 0; i < found.size(); ++i)
+            out += (i ? "," : "") + found[i];
+        return out + "]";
+    }
+
+    std::string respond(std::string_view target) const {
+        constexpr std::string_view kEmpty = R"({"info":{"count":0,"pages":1,"next":null,"prev":null},"results":[]})";
+        if (target == "/api/location" || target == "/api/episode")
+            return std::string(kEmpty);
+        if (target == "/api/character")
+            return page(1);
+        if (target.starts_with("/api/character?page=")) {
+            int number = std::stoi(std::string(target.substr(20)));
+            if (number == fail_page)
+                throw UpstreamError(503);
+            return page(number);
+        }
+        if (target.starts_with("/api/character/"))
+            return entities(target.substr(15), [&](int id) { return id >= 1 && id <= characters_; }, character);
+        if (target.starts_with("/api/episode/"))
+            return entities(target.substr(13), [&](int id) { return episodes.contains(id); },
+                            [&](int id) { return episode(id); });
+        if (target.starts_with("/api/location/"))
+            return entities(target.substr(14), [&](int id) { return locations.contains(id); },
+                            [&](int id) { return location(id); });
+        return R"({"error":"There is nothing here"})";
+    }
+
+    int characters_;
+    mutable std::mutex mutex_;
+    std::vector<std::string> targets_;
+    int in_flight_ = 0;
+    int max_in_flight_ = 0;
+};
@@ -1,15 +1,18 @@
 #include <gtest/gtest.h>
 #include <boost/asio/write.hpp>
 #include <boost/asio/read.hpp>
+#include <boost/asio/detached.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "handler.hpp"
 #include "api.hpp"
 #include "utils.hpp"
 #include "models.hpp"
+#include "fake_upstream.hpp"
 
 namespace beast = boost::beast;
 namespace http  = beast::http;
@@ -197,3 +200,117 @@ TEST(EndpointTest, EpisodeQueryProxy) {
     EXPECT_FALSE(body.empty());
     EXPECT_TRUE(obj.contains("info") || obj.contains("results"));
 }
+
+TEST(EndpointTest, KeepAlivePipelined) {
+    net::io_context ioc;
+    net::thread_pool upstream{1};
+    HttpClient client(false);
+    RickAndMortyApi api(client);
+
+    net::ip::tcp::acceptor acceptor{ioc, {net::ip::address_v4::loopback(), 0}};
+    net::ip::tcp::socket sock{ioc};
+    sock.connect(acceptor.local_endpoint());
+    auto server_socket = acceptor.accept();
+
+    net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+        Handler handler(beast::tcp_stream(std::move(server_socket)), api, upstream);
+        co_await handler.handle();
+    }, net::detached);
+    std::thread server([&]{ ioc.run(); });
+
+    std::string raw_req =
+        "GET /help HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        "GET /help HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    net::write(sock, net::buffer(raw_req));
+
+    beast::flat_buffer buffer;
+    http::response<http::string_body> first, second;
+    http::read(sock, buffer, first);
+    http::read(sock, buffer, second);
+    server.join();
+
+    EXPECT_EQ(first.result(), http::status::ok);
+    EXPECT_TRUE(first.keep_alive());
+    EXPECT_FALSE(second.keep_alive());
+    EXPECT_EQ(first.body(), second.body());
+}
+
+TEST(EndpointTest, CharacterAllStreamsThenCaches) {
+    net::io_context ioc;
+    net::thread_pool upstream{1};
+    FakeUpstream client(45);
+    RickAndMortyApi api(client);
+
+    net::ip::tcp::acceptor acceptor{ioc, {net::ip::address_v4::loopback(), 0}};
+    net::ip::tcp::socket sock{ioc};
+    sock.connect(acceptor.local_endpoint());
+    auto server_socket = acceptor.accept();
+
+    net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+        Handler handler(beast::tcp_stream(std::move(server_socket)), api, upstream);
+        co_await handler.handle();
+    }, net::detached);
+    std::thread server([&]{ ioc.run(); });
+
+    std::string raw_req = "GET /character/all HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    net::write(sock, net::buffer(raw_req));
+
+    beast::flat_buffer buffer;
+    http::response_parser<http::string_body> parser;
+    int chunks = 0;
+    auto on_chunk = [&](std::uint64_t size, beast::string_view, beast::error_code&) {
+        if (size > 0)
+            ++chunks;
+    };
+    parser.on_chunk_header(on_chunk);
+    http::read(sock, buffer, parser);
+    server.join();
+
+    auto res = parser.release();
+    EXPECT_EQ(res.result(), http::status::ok);
+    EXPECT_TRUE(res.chunked());
+    // Page 1, then pages 2-3 as one group, then the closing bracket.
+    EXPECT_EQ(chunks, 3);
+
+    auto arr = json::parse(res.body()).as_object().at("characters").as_array();
+    ASSERT_EQ(arr.size(), 45);
+    for (std::size_t i = 0; i < arr.size(); ++i)
+        EXPECT_EQ(arr[i].as_object().at("id").as_int64(), static_cast<int64_t>(i + 1));
+
+    auto cached = api.cached_all_characters_json();
+    ASSERT_NE(cached, nullptr);
+    EXPECT_EQ(*cached, res.body());
+}
+
+TEST(EndpointTest, CharacterAllBrokenStreamIsNotCached) {
+    net::io_context ioc;
+    net::thread_pool upstream{1};
+    FakeUpstream client(45);
+    client.fail_page = 3;
+    RickAndMortyApi api(client);
+
+    net::ip::tcp::acceptor acceptor{ioc, {net::ip::address_v4::loopback(), 0}};
+    net::ip::tcp::socket sock{ioc};
+    sock.connect(acceptor.local_endpoint());
+    auto server_socket = acceptor.accept();
+
+    net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+        Handler handler(beast::tcp_stream(std::move(server_socket)), api, upstream);
+        co_await handler.handle();
+    }, net::detached);
+    std::thread server([&]{ ioc.run(); });
+
+    std::string raw_req = "GET /character/all HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    net::write(sock, net::buffer(raw_req));
+
+    // Headers went out before page 3 failed, so the server can only close.
+    beast::flat_buffer buffer;
+    http::response<http::string_body> res;
+    beast::error_code ec;
+    http::read(sock, buffer, res, ec);
+    server.join();
+
+    EXPECT_TRUE(ec);
+    EXPECT_FALSE(api.characters_complete());
+    EXPECT_EQ(api.cached_all_characters_json(), nullptr);
+}
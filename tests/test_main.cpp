@@ -6,16 +6,42 @@
 
 #include <boost/json/src.hpp>
 #include <boost/json.hpp>
+#include <boost/asio/detached.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/url.hpp>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
 #include <sstream>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <thread>
+#include <vector>
 
+#include "cache.hpp"
+#include "deadline.hpp"
+#include "decoder.hpp"
+#include "hedge.hpp"
+#include "http_client.hpp"
+#include "metrics.hpp"
+#include "query.hpp"
+#include "response_cache.hpp"
+#include "retry.hpp"
+#include "route.hpp"
+#include "serialize.hpp"
+#include "shared_body.hpp"
+#include "single_flight.hpp"
+#include "snapshot.hpp"
+#include "trace.hpp"
 #include "handler.hpp"
 #include "models.hpp"
 #include "utils.hpp"
 #include "api.hpp"
+#include "fake_upstream.hpp"
 
 namespace beast = boost::beast;
 namespace http  = beast::http;
@@ -28,6 +54,39 @@ TEST(UtilsTest, ParseHttpsUrl) {
     EXPECT_FALSE(target.empty());
 }
 
+TEST(UtilsTest, NormalizeTarget) {
+    EXPECT_EQ(normalize_target("/api/character/?status=alive&name=rick"),
+              normalize_target("/api/character?name=rick&status=alive"));
+    EXPECT_EQ(normalize_target("/api/location/3"), "/api/location/3");
+    EXPECT_EQ(normalize_target("/api/episode/?"), "/api/episode");
+}
+
+TEST(UtilsTest, ParseQuery) {
+    auto params = parse_query("name=rick%20sanchez&status=alive&&flag&species=Mythological+Creature");
+    ASSERT_EQ(params.size(), 4);
+    EXPECT_EQ(params[0], (std::pair<std::string, std::string>{"name", "rick sanchez"}));
+    EXPECT_EQ(params[2], (std::pair<std::string, std::string>{"flag", ""}));
+    EXPECT_EQ(params[3].second, "Mythological Creature");
+}
+
+TEST(ModelTest, SymbolsAreInterned) {
+    std::string status = "Alive";
+    Symbol a(status);
+    status[0] = 'X';
+    Symbol b("Alive");
+
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a.data(), b.data());
+    EXPECT_EQ(a.view(), "Alive");
+    EXPECT_TRUE(Symbol().empty());
+    EXPECT_EQ(Symbol(""), Symbol());
+
+    auto before = symbol_arena_bytes();
+    Symbol("Interned once, symbol test");
+    Symbol("Interned once, symbol test");
+    EXPECT_EQ(symbol_arena_bytes(), before + std::string_view("Interned once, symbol test").size());
+}
+
 TEST(ModelTest, CharacterStruct) {
     Character c;
     c.id = 10;
@@ -36,6 +95,840 @@ TEST(ModelTest, CharacterStruct) {
     EXPECT_EQ(c.name, "Test");
 }
 
+TEST(CacheTest, ShardedCacheSharesHandles) {
+    ShardedCache<int, Character> cache;
+    Character c;
+    c.id = 1;
+    c.name = "Rick Sanchez";
+
+    auto inserted = cache.insert(c.id, c);
+    auto found    = cache.find(1);
+
+    EXPECT_EQ(inserted, found);
+    EXPECT_EQ(found->name, "Rick Sanchez");
+    EXPECT_EQ(cache.find(2), nullptr);
+    EXPECT_EQ(cache.peek(1), found);
+
+    c.name = "Other";
+    EXPECT_EQ(cache.insert(1, c)->name, "Rick Sanchez");
+    EXPECT_EQ(cache.assign(1, c)->name, "Other");
+    EXPECT_EQ(cache.size(), 1);
+    cache.assign(2, c);
+    EXPECT_EQ(cache.size(), 2);
+}
+
+TEST(CacheTest, ShardedCacheConcurrentAccess) {
+    ShardedCache<int, Character> cache;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&cache, t]{
+            for (int id = 1; id <= 1000; ++id) {
+                if (id % 4 == t) {
+                    Character c;
+                    c.id = id;
+                    cache.insert(id, c);
+                }
+                if (auto hit = cache.find(id))
+                    EXPECT_EQ(hit->id, id);
+            }
+        });
+    }
+    for (auto& th : threads)
+        th.join();
+
+    EXPECT_EQ(cache.size(), 1000);
+}
+
+TEST(CacheTest, ResponseCacheEvictsLeastRecentlyUsed) {
+    ResponseCache cache(20);
+    cache.put("a", "1234567", std::chrono::seconds(60));
+    cache.put("b", "1234567", std::chrono::seconds(60));
+    EXPECT_NE(cache.get("a"), nullptr);
+
+    cache.put("c", "1234567", std::chrono::seconds(60));
+    EXPECT_NE(cache.get("a"), nullptr);
+    EXPECT_EQ(cache.get("b"), nullptr);
+    EXPECT_EQ(*cache.get("c"), "1234567");
+    EXPECT_LE(cache.bytes(), 20);
+}
+
+TEST(CacheTest, ResponseCacheExpiresEntries) {
+    ResponseCache cache(1024);
+    cache.put("a", "body", std::chrono::seconds(0));
+    EXPECT_EQ(cache.get("a"), nullptr);
+    ASSERT_NE(cache.get_stale("a"), nullptr);
+    EXPECT_EQ(*cache.get_stale("a"), "body");
+    EXPECT_EQ(cache.get_stale("b"), nullptr);
+}
+
+TEST(SingleFlightTest, ConcurrentCallsShareOneExecution) {
+    SingleFlight<std::string> flight;
+    std::atomic<int> executions{0};
+    std::vector<std::thread> threads;
+    std::vector<std::string> results(8);
+
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&, i]{
+            results[i] = flight.run("/api/episode/28", [&]{
+                ++executions;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                return std::string("episode");
+            });
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_LT(executions.load(), 8);
+    for (auto const& r : results)
+        EXPECT_EQ(r, "episode");
+}
+
+TEST(SingleFlightTest, ErrorsReachEveryWaiter) {
+    SingleFlight<std::string> flight;
+    std::promise<void> release;
+    auto gate = release.get_future().share();
+    std::promise<void> started;
+
+    std::thread leader([&]{
+        EXPECT_THROW(flight.run("k", [&]() -> std::string {
+            started.set_value();
+            gate.wait();
+            throw std::runtime_error("upstream down");
+        }), std::runtime_error);
+    });
+    started.get_future().wait();
+
+    bool follower_ran = false;
+    std::string follower_error;
+    std::thread follower([&]{
+        try {
+            flight.run("k", [&]{ follower_ran = true; return std::string("ok"); });
+        }
+        catch (std::runtime_error const& e) {
+            follower_error = e.what();
+        }
+    });
+
+    // Give the follower time to join the leader's call before it fails.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release.set_value();
+    leader.join();
+    follower.join();
+
+    EXPECT_FALSE(follower_ran);
+    EXPECT_EQ(follower_error, "upstream down");
+    EXPECT_EQ(flight.run("k", []{ return std::string("ok"); }), "ok");
+}
+
+TEST(SingleFlightTest, JoinerGivesUpAtItsDeadline) {
+    SingleFlight<int> flight;
+    std::promise<void> release;
+    auto gate = release.get_future().share();
+    std::promise<void> started;
+
+    std::thread leader([&]{
+        flight.run("k", [&]{ started.set_value(); gate.wait(); return 1; });
+    });
+    started.get_future().wait();
+
+    DeadlineScope scope(std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+    EXPECT_THROW(flight.run("k", []{ return 2; }), DeadlineExceeded);
+
+    release.set_value();
+    leader.join();
+}
+
+TEST(SingleFlightTest, JoinerOutlivesLeaderDeadline) {
+    SingleFlight<int> flight;
+    std::promise<void> release;
+    auto gate = release.get_future().share();
+    std::promise<void> started;
+
+    std::thread leader([&]{
+        DeadlineScope scope(std::chrono::steady_clock::now() + std::chrono::milliseconds(20));
+        EXPECT_THROW(flight.run("k", [&]() -> int {
+            started.set_value();
+            gate.wait();
+            throw DeadlineExceeded();
+        }), DeadlineExceeded);
+    });
+    started.get_future().wait();
+
+    int follower_result = 0;
+    std::thread follower([&]{
+        DeadlineScope scope(std::chrono::steady_clock::now() + std::chrono::seconds(10));
+        follower_result = flight.run("k", []{ return 2; });
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release.set_value();
+    leader.join();
+    follower.join();
+
+    EXPECT_EQ(follower_result, 2);
+}
+
+TEST(SnapshotTest, RoundTripAndValidation) {
+    const std::string path = "snapshot_test.bin";
+
+    Character c;
+    c.id = 2;
+    c.name = "Morty Smith";
+    c.status = "Alive";
+    c.episode_ids = {1, 2, 3};
+
+    Episode ep;
+    ep.id = 1;
+    ep.name = "Pilot";
+    ep.character_ids = {2};
+
+    Location loc;
+    loc.id = 3;
+    loc.name = "Citadel of Ricks";
+    loc.resident_ids = {2, 8};
+
+    ASSERT_TRUE(write_snapshot(path, {std::make_shared<const Character>(c)},
+                                     {std::make_shared<const Episode>(ep)},
+                                     {std::make_shared<const Location>(loc)}, 826));
+
+    auto snap = read_snapshot(path, std::chrono::hours(1));
+    ASSERT_TRUE(snap.has_value());
+    EXPECT_EQ(snap->character_upstream_count, 826);
+    ASSERT_EQ(snap->characters.size(), 1);
+    EXPECT_EQ(snap->characters[0].name, "Morty Smith");
+    EXPECT_EQ(snap->characters[0].episode_ids, (std::vector<int>{1, 2, 3}));
+    ASSERT_EQ(snap->episodes.size(), 1);
+    EXPECT_EQ(snap->episodes[0].character_ids, (std::vector<int>{2}));
+    ASSERT_EQ(snap->locations.size(), 1);
+    EXPECT_EQ(snap->locations[0].name, "Citadel of Ricks");
+    EXPECT_EQ(snap->locations[0].resident_ids, (std::vector<int>{2, 8}));
+
+    {
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(-1, std::ios::end);
+        f.put('x');
+    }
+    EXPECT_FALSE(read_snapshot(path, std::chrono::hours(1)).has_value());
+    std::remove(path.c_str());
+}
+
+TEST(DecoderTest, CharacterPage) {
+    std::string body = R"J({"info":{"count":826,"pages":42,"next":null,"prev":null},"results":[
+        {"id":1,"name":"Rick Sanchez","status":"Alive","species":"Human","type":"","gender":"Male",
+         "origin":{"name":"Earth (C-137)","url":"https://rickandmortyapi.com/api/location/1"},
+         "location":{"name":"Citadel of Ricks","url":"https://rickandmortyapi.com/api/location/3"},
+         "episode":["https://rickandmortyapi.com/api/episode/1","https://rickandmortyapi.com/api/episode/2"]},
+        {"id":2,"name":"Morty Smith","status":"Alive","species":"Human","gender":"Male",
+         "origin":{"name":"unknown","url":""},"location":{"name":"Earth","url":""},"episode":[]}]})J";
+
+    auto page = decode_characters(body);
+    EXPECT_EQ(page.count, 826);
+    EXPECT_EQ(page.pages, 42);
+    ASSERT_EQ(page.results.size(), 2);
+    EXPECT_EQ(page.results[0].name, "Rick Sanchez");
+    EXPECT_EQ(page.results[0].origin_name, "Earth (C-137)");
+    EXPECT_EQ(page.results[0].location_name, "Citadel of Ricks");
+    EXPECT_EQ(page.results[0].episode_ids, (std::vector<int>{1, 2}));
+    EXPECT_EQ(page.results[0].origin_id, 1);
+    EXPECT_EQ(page.results[0].location_id, 3);
+    EXPECT_EQ(page.results[1].id, 2);
+    EXPECT_EQ(page.results[1].origin_id, 0);
+    EXPECT_EQ(decode_page_info(body).pages, 42);
+}
+
+TEST(DecoderTest, SingleArrayAndErrors) {
+    auto single = decode_characters(R"({"id":7,"name":"Abradolf Lincler","episode":["https://rickandmortyapi.com/api/episode/10"]})");
+    ASSERT_EQ(single.results.size(), 1);
+    EXPECT_EQ(single.results[0].episode_ids, (std::vector<int>{10}));
+
+    auto many = decode_characters(R"([{"id":1,"name":"A"},{"id":2,"name":"B"}])");
+    ASSERT_EQ(many.results.size(), 2);
+    EXPECT_EQ(many.results[1].name, "B");
+
+    auto ep = decode_episodes(R"({"id":28,"name":"The Ricklantis Mixup","episode":"S03E07",
+        "characters":["https://rickandmortyapi.com/api/character/1","https://rickandmortyapi.com/api/character/2"]})");
+    ASSERT_EQ(ep.results.size(), 1);
+    EXPECT_EQ(ep.results[0].character_ids, (std::vector<int>{1, 2}));
+
+    auto loc = decode_locations(R"([{"id":3,"name":"Citadel of Ricks","type":"Space station","dimension":"unknown",
+        "residents":["https://rickandmortyapi.com/api/character/8","https://rickandmortyapi.com/api/character/14"]}])");
+    ASSERT_EQ(loc.results.size(), 1);
+    EXPECT_EQ(loc.results[0].dimension, "unknown");
+    EXPECT_EQ(loc.results[0].resident_ids, (std::vector<int>{8, 14}));
+
+    EXPECT_THROW(decode_characters(R"({"error":"Character not found"})"), std::runtime_error);
+    EXPECT_THROW(decode_characters(R"({"id":1,)"), std::runtime_error);
+    EXPECT_THROW(decode_characters(R"("Character not found")"), std::runtime_error);
+    EXPECT_THROW(decode_page_info("42"), std::runtime_error);
+    EXPECT_EQ(url_id("https://rickandmortyapi.com/api/episode/28"), 28);
+    EXPECT_FALSE(url_id("https://rickandmortyapi.com/api/episode/").has_value());
+}
+
+TEST(SerializeTest, CharacterBodies) {
+    Character c;
+    c.id = 1;
+    c.name = "Rick Sanchez";
+    c.status = "Alive";
+    c.episode_ids = {1, 2};
+
+    auto parsed = boost::json::parse(serialize_character(c)).as_object();
+    EXPECT_EQ(parsed.at("id").as_int64(), 1);
+    EXPECT_EQ(std::string_view(parsed.at("name").as_string()), "Rick Sanchez");
+    EXPECT_EQ(parsed.at("episodes").as_array().size(), 2);
+
+    auto handle = std::make_shared<const Character>(c);
+    EXPECT_EQ(serialize_character_list({handle}),
+              R"({"characters":[{"id":1,"name":"Rick Sanchez"}]})");
+}
+
+TEST(SerializeTest, SharedBodyWritesWithoutCopy) {
+    auto body = std::make_shared<const std::string>(R"({"id":1})");
+
+    boost::beast::http::response<shared_string_body> res{boost::beast::http::status::ok, 11};
+    res.body() = body;
+    res.prepare_payload();
+
+    std::ostringstream out;
+    out << res;
+
+    EXPECT_EQ(body.use_count(), 2);
+    EXPECT_NE(out.str().find("Content-Length: 8"), std::string::npos);
+    EXPECT_TRUE(out.str().ends_with("\r\n\r\n{\"id\":1}"));
+}
+
+TEST(QueryTest, IndexMatchesUpstreamSemantics) {
+    auto make = [](int id, const char* name, const char* status, const char* species, const char* type) {
+        Character c;
+        c.id = id;
+        c.name = name;
+        c.status = status;
+        c.species = species;
+        c.type = type;
+        c.gender = "Male";
+        return std::make_shared<const Character>(std::move(c));
+    };
+
+    CharacterIndex index({
+        make(3, "Summer Smith", "Alive", "Human", ""),
+        make(1, "Rick Sanchez", "Alive", "Human", ""),
+        make(8, "Adjudicator Rick", "Dead", "Human", ""),
+        make(20, "Ants in my Eyes Johnson", "unknown", "Human", "Human with ants in his eyes"),
+    });
+
+    auto ids = [&](std::string_view query) {
+        std::vector<int> out;
+        for (auto const& c : index.match(*parse_character_query(query)))
+            out.push_back(c->id);
+        return out;
+    };
+
+    EXPECT_EQ(ids("name=rick"), (std::vector<int>{1, 8}));
+    EXPECT_EQ(ids("name=RICK&status=alive"), (std::vector<int>{1}));
+    EXPECT_EQ(ids("status=ali"), (std::vector<int>{}));
+    EXPECT_EQ(ids("type=ants"), (std::vector<int>{20}));
+    EXPECT_EQ(ids("name=ri"), (std::vector<int>{1, 8}));
+    EXPECT_EQ(ids("gender=male&page=2"), (std::vector<int>{1, 3, 8, 20}));
+
+    auto q = parse_character_query("page=2&name=rick&status=alive");
+    ASSERT_TRUE(q);
+    EXPECT_EQ(q->page, 2);
+    EXPECT_EQ(q->filters, "name=rick&status=alive");
+    EXPECT_FALSE(parse_character_query("episode=1"));
+    EXPECT_FALSE(parse_character_query("page=0"));
+}
+
+TEST(RouteTest, MatchesResourceAndShape) {
+    static_assert(find_resource("character") == Resource::Character);
+    static_assert(!find_resource("characters").has_value());
+
+    EXPECT_EQ(match_route("/help").shape, Shape::Index);
+    EXPECT_EQ(match_route("/help/x").shape, Shape::NotFound);
+
+    auto all = match_route("/location/all");
+    EXPECT_EQ(all.resource, Resource::Location);
+    EXPECT_EQ(all.shape, Shape::All);
+
+    auto single = match_route("/character/42");
+    EXPECT_EQ(single.shape, Shape::Single);
+    EXPECT_EQ(single.id, 42);
+
+    auto batch = match_route("/episode/1,2,3");
+    EXPECT_EQ(batch.shape, Shape::Batch);
+    EXPECT_EQ(batch.ids, "1,2,3");
+
+    auto query = match_route("/character/?name=rick&status=alive");
+    EXPECT_EQ(query.shape, Shape::Query);
+    EXPECT_EQ(query.query, "name=rick&status=alive");
+
+    EXPECT_EQ(match_route("/character/-1").shape, Shape::NotFound);
+    EXPECT_EQ(match_route("/character/abc").shape, Shape::NotFound);
+    EXPECT_EQ(match_route("/planet/1").shape, Shape::NotFound);
+}
+
+TEST(RouteTest, ParsesIdLists) {
+    std::vector<int> ids;
+    EXPECT_TRUE(parse_id_list("1,,20,3", ids));
+    EXPECT_EQ(ids, (std::vector<int>{1, 20, 3}));
+
+    ids.clear();
+    EXPECT_FALSE(parse_id_list("1,a", ids));
+    EXPECT_FALSE(parse_id_list("1,-2", ids));
+    EXPECT_FALSE(parse_id_list("99999999999", ids));
+}
+
+TEST(RetryTest, CircuitBreakerOpensAndProbes) {
+    CircuitBreaker breaker(2, std::chrono::hours(1));
+    EXPECT_TRUE(breaker.allow());
+    breaker.on_failure();
+    EXPECT_TRUE(breaker.allow());
+    breaker.on_failure();
+    EXPECT_FALSE(breaker.allow());
+    EXPECT_TRUE(breaker.open());
+
+    CircuitBreaker probing(1, std::chrono::milliseconds(0));
+    probing.on_failure();
+    EXPECT_TRUE(probing.allow());
+    EXPECT_FALSE(probing.allow());
+    probing.on_success();
+    EXPECT_TRUE(probing.allow());
+    EXPECT_FALSE(probing.open());
+
+    CircuitBreaker abandoned(1, std::chrono::milliseconds(0));
+    abandoned.on_failure();
+    EXPECT_TRUE(abandoned.allow());
+    abandoned.on_abandoned();
+    EXPECT_TRUE(abandoned.allow());
+}
+
+TEST(RetryTest, ClassifiesErrors) {
+    EXPECT_TRUE(is_retryable(std::make_exception_ptr(UpstreamError(503))));
+    EXPECT_TRUE(is_retryable(std::make_exception_ptr(UpstreamError(429))));
+    EXPECT_TRUE(is_retryable(std::make_exception_ptr(
+        boost::system::system_error(boost::asio::error::timed_out))));
+    EXPECT_FALSE(is_retryable(std::make_exception_ptr(CircuitOpenError("rickandmortyapi.com"))));
+    EXPECT_FALSE(is_retryable(std::make_exception_ptr(std::runtime_error("Character not found"))));
+
+    RetryPolicy policy{5, std::chrono::milliseconds(100), std::chrono::milliseconds(300)};
+    for (int attempt = 1; attempt <= 5; ++attempt) {
+        EXPECT_LT(backoff_delay(policy, attempt), std::chrono::milliseconds(300));
+    }
+}
+
+TEST(RetryTest, RetriesOnlyTransientFailures) {
+    namespace net = boost::asio;
+    RetryPolicy fast{3, std::chrono::milliseconds(1), std::chrono::milliseconds(2)};
+    net::io_context ioc;
+
+    int calls = 0;
+    int result = 0;
+    net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+        result = co_await with_retry([&]() -> net::awaitable<int> {
+            if (++calls < 3)
+                throw boost::system::system_error(net::error::connection_reset);
+            co_return 7;
+        }, fast);
+    }, net::detached);
+    ioc.run();
+    EXPECT_EQ(result, 7);
+    EXPECT_EQ(calls, 3);
+
+    calls = 0;
+    bool failed = false;
+    ioc.restart();
+    net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+        try {
+            co_await with_retry([&]() -> net::awaitable<int> {
+                ++calls;
+                throw std::runtime_error("Character not found");
+                co_return 0;
+            }, fast);
+        }
+        catch (std::runtime_error const&) {
+            failed = true;
+        }
+    }, net::detached);
+    ioc.run();
+    EXPECT_TRUE(failed);
+    EXPECT_EQ(calls, 1);
+}
+
+TEST(RetryTest, StopsAtDeadline) {
+    namespace net = boost::asio;
+    RetryPolicy policy{10, std::chrono::milliseconds(50), std::chrono::milliseconds(50)};
+    policy.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+    net::io_context ioc;
+
+    int calls = 0;
+    bool timed_out = false;
+    net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+        try {
+            co_await with_retry([&]() -> net::awaitable<int> {
+                ++calls;
+                throw boost::system::system_error(net::error::connection_reset);
+                co_return 0;
+            }, policy);
+        }
+        catch (DeadlineExceeded const&) {
+            timed_out = true;
+        }
+    }, net::detached);
+    ioc.run();
+    EXPECT_TRUE(timed_out);
+    EXPECT_LT(calls, 10);
+}
+
+// Local TLS upstream with a throwaway self-signed certificate. It serves its
+// connections one after another, answering every GET with "ok", and can drop
+// each connection right after its first response without saying so.
+struct TlsUpstream {
+    net::io_context ioc;
+    net::ssl::context ctx{net::ssl::context::tlsv12_server};
+    net::ip::tcp::acceptor acceptor{ioc, {net::ip::address_v4::loopback(), 0}};
+    std::atomic<int> accepted{0};
+    std::atomic<int> resumed{0};
+    std::thread thread;
+
+    TlsUpstream(int connections, bool drop_after_response) {
+        EVP_PKEY* key = EVP_EC_gen("P-256");
+        X509* cert = X509_new();
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+                                   reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(cert, X509_get_subject_name(cert));
+        X509_sign(cert, key, EVP_sha256());
+        SSL_CTX_use_certificate(ctx.native_handle(), cert);
+        SSL_CTX_use_PrivateKey(ctx.native_handle(), key);
+        X509_free(cert);
+        EVP_PKEY_free(key);
+
+        thread = std::thread([this, connections, drop_after_response] {
+            for (int i = 0; i < connections; ++i) {
+                net::ssl::stream<net::ip::tcp::socket> stream(acceptor.accept(), ctx);
+                ++accepted;
+                boost::system::error_code ec;
+                stream.handshake(net::ssl::stream_base::server, ec);
+                if (ec)
+                    continue;
+                if (SSL_session_reused(stream.native_handle()))
+                    ++resumed;
+
+                beast::flat_buffer buffer;
+                for (;;) {
+                    http::request<http::empty_body> req;
+                    http::read(stream, buffer, req, ec);
+                    if (ec)
+                        break;
+                    http::response<http::string_body> res{http::status::ok, 11};
+                    res.body() = "ok";
+                    res.keep_alive(true);
+                    res.prepare_payload();
+                    http::write(stream, res, ec);
+                    if (ec || drop_after_response)
+                        break;
+                }
+            }
+        });
+    }
+
+    ~TlsUpstream() { thread.join(); }
+
+    std::string host() const { return "localhost:" + std::to_string(acceptor.local_endpoint().port()); }
+};
+
+TEST(HttpClientTest, ReusesPooledConnections) {
+    TlsUpstream upstream(1, false);
+    {
+        HttpClient client;
+        EXPECT_EQ(client.get(upstream.host(), "/api/character/1"), "ok");
+        EXPECT_EQ(client.get(upstream.host(), "/api/character/2"), "ok");
+        EXPECT_EQ(client.get(upstream.host(), "/api/character/3"), "ok");
+    }
+    EXPECT_EQ(upstream.accepted.load(), 1);
+}
+
+TEST(HttpClientTest, ReconnectsWhenPooledConnectionWasDropped) {
+    TlsUpstream upstream(2, true);
+    {
+        HttpClient client;
+        EXPECT_EQ(client.get(upstream.host(), "/api/character/1"), "ok");
+        // The pooled connection is dead; the client retries once on a fresh
+        // one and offers the previous TLS session.
+        EXPECT_EQ(client.get(upstream.host(), "/api/character/2"), "ok");
+    }
+    EXPECT_EQ(upstream.accepted.load(), 2);
+    EXPECT_EQ(upstream.resumed.load(), 1);
+}
+
+// Primes RickAndMortyApi's caches as earlier requests would have, without
+// going through the fake upstream.
+struct ApiTestAccess {
+    static void prime_characters(RickAndMortyApi& api, const std::vector<int>& ids) {
+        for (int id : ids)
+            api.store_character(std::move(decode_characters(FakeUpstream::character(id)).results.front()));
+    }
+};
+
+TEST(ApiTest, FetchesPagesConcurrentlyInPageOrder) {
+    FakeUpstream upstream(400);
+    upstream.delay = std::chrono::milliseconds(20);
+    RickAndMortyApi api(upstream);
+
+    auto page = api.get_characters_pages(1, 20);
+    ASSERT_EQ(page.results.size(), 400);
+    for (int i = 0; i < 400; ++i)
+        EXPECT_EQ(page.results[i]->id, i + 1);
+    EXPECT_EQ(page.pages, 20);
+    EXPECT_EQ(upstream.targets().size(), 20u);
+    EXPECT_GT(upstream.max_in_flight(), 1);
+    EXPECT_LE(upstream.max_in_flight(), 8);
+}
+
+TEST(ApiTest, PageFailureReachesTheCaller) {
+    FakeUpstream upstream(100);
+    upstream.fail_page = 3;
+    RickAndMortyApi api(upstream);
+
+    EXPECT_THROW(api.get_characters_pages(1, 5), UpstreamError);
+    upstream.fail_page = 0;
+    EXPECT_EQ(api.get_characters_pages(1, 5).results.size(), 100);
+}
+
+template<class Ptr>
+std::vector<int> ids_of(const std::vector<Ptr>& entities) {
+    std::vector<int> ids;
+    for (auto const& e : entities)
+        ids.push_back(e->id);
+    return ids;
+}
+
+TEST(ApiTest, CharactersKeepRequestOrderAndFetchOnlyMisses) {
+    FakeUpstream upstream(300);
+    RickAndMortyApi api(upstream);
+    ApiTestAccess::prime_characters(api, {2, 4});
+
+    // Duplicates come back once per mention; unknown ids are dropped.
+    auto got = api.get_characters({5, 2, 999, 3, 5, 1, 4, 3});
+    EXPECT_EQ(ids_of(got), (std::vector<int>{5, 2, 3, 5, 1, 4, 3}));
+    EXPECT_EQ(upstream.targets(), std::vector<std::string>{"/api/character/5,999,3,1"});
+
+    upstream.clear();
+    EXPECT_EQ(ids_of(api.get_characters({3, 1})), (std::vector<int>{3, 1}));
+    EXPECT_TRUE(upstream.targets().empty());
+}
+
+TEST(ApiTest, CharacterMissesGoUpstreamInChunksOf100) {
+    FakeUpstream upstream(300);
+    RickAndMortyApi api(upstream);
+    ApiTestAccess::prime_characters(api, {250});
+
+    std::vector<int> ids;
+    for (int id = 251; id >= 1; --id)
+        ids.push_back(id);
+    EXPECT_EQ(ids_of(api.get_characters(ids)), ids);
+
+    auto targets = upstream.targets();
+    ASSERT_EQ(targets.size(), 3u);
+    EXPECT_TRUE(targets[0].starts_with("/api/character/251,249,248,"));
+    EXPECT_TRUE(targets[0].ends_with(",152,151"));
+    EXPECT_TRUE(targets[1].starts_with("/api/character/150,"));
+    EXPECT_TRUE(targets[1].ends_with(",52,51"));
+    EXPECT_TRUE(targets[2].starts_with("/api/character/50,"));
+    EXPECT_TRUE(targets[2].ends_with(",2,1"));
+}
+
+TEST(ApiTest, LocationsKeepRequestOrderAndFetchOnlyMisses) {
+    FakeUpstream upstream;
+    upstream.locations = {{1, {3, 1}}, {2, {2}}, {3, {1, 2}}};
+    RickAndMortyApi api(upstream);
+    ApiTestAccess::prime_characters(api, {1});
+    api.get_locations({2});
+    upstream.clear();
+
+    auto got = api.get_locations({3, 2, 1, 3});
+    EXPECT_EQ(ids_of(got), (std::vector<int>{3, 2, 1, 3}));
+    // One batch for the missing locations, then one for residents nobody
+    // had cached yet.
+    EXPECT_EQ(upstream.targets(), (std::vector<std::string>{"/api/location/3,1", "/api/character/3"}));
+    EXPECT_EQ(got[2]->resident_ids, (std::vector<int>{3, 1}));
+}
+
+TEST(ApiTest, EpisodeBatchesCharacterMissesAndSortsByName) {
+    FakeUpstream upstream;
+    upstream.episodes = {{7, {2, 10, 1, 12}}};
+    RickAndMortyApi api(upstream);
+    ApiTestAccess::prime_characters(api, {10});
+
+    auto ep = api.get_episode(7);
+    EXPECT_EQ(upstream.targets(), (std::vector<std::string>{"/api/episode/7", "/api/character/2,1,12"}));
+    // "Character 10" sorts before "Character 2".
+    EXPECT_EQ(ep->character_ids, (std::vector<int>{1, 10, 12, 2}));
+
+    upstream.clear();
+    EXPECT_EQ(api.get_episode(7), ep);
+    EXPECT_TRUE(upstream.targets().empty());
+}
+
+TEST(ApiTest, PartialCharacterListIsNeverCached) {
+    FakeUpstream upstream(45);
+    RickAndMortyApi api(upstream);
+    EXPECT_FALSE(api.characters_complete());
+
+    api.get_characters_pages(1, 2);
+    ApiTestAccess::prime_characters(api, {41, 42});
+    EXPECT_FALSE(api.characters_complete());
+    EXPECT_EQ(api.cached_all_characters_json(), nullptr);
+
+    api.get_characters_pages(3, 3);
+    EXPECT_TRUE(api.characters_complete());
+    EXPECT_EQ(api.cached_all_characters_json(), nullptr);
+
+    // A complete cache answers without upstream and keeps the body.
+    upstream.clear();
+    auto body = api.get_all_characters_json();
+    EXPECT_TRUE(upstream.targets().empty());
+    EXPECT_EQ(json::parse(*body).as_object().at("characters").as_array().size(), 45);
+    EXPECT_EQ(api.cached_all_characters_json(), body);
+
+    // A character stored later retires it.
+    ApiTestAccess::prime_characters(api, {46});
+    EXPECT_EQ(api.cached_all_characters_json(), nullptr);
+}
+
+TEST(DeadlineTest, ScopesNestPerThread) {
+    using namespace std::chrono;
+    EXPECT_EQ(current_deadline(), kNoDeadline);
+    EXPECT_NO_THROW(check_deadline());
+
+    auto soon = steady_clock::now() + hours(1);
+    {
+        DeadlineScope outer(soon);
+        EXPECT_EQ(current_deadline(), soon);
+        std::thread([]{ EXPECT_EQ(current_deadline(), kNoDeadline); }).join();
+        {
+            DeadlineScope inner(steady_clock::now() - milliseconds(1));
+            EXPECT_THROW(check_deadline(), DeadlineExceeded);
+        }
+        EXPECT_NO_THROW(check_deadline());
+    }
+    EXPECT_EQ(current_deadline(), kNoDeadline);
+}
+
+TEST(MetricsTest, CountersSumAcrossThreads) {
+    Counter counter;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t)
+        threads.emplace_back([&]{ for (int i = 0; i < 1000; ++i) counter.add(); });
+    for (auto& t : threads)
+        t.join();
+    EXPECT_EQ(counter.value(), 8000u);
+
+    Histogram histogram;
+    histogram.observe(std::chrono::microseconds(500));
+    histogram.observe(std::chrono::milliseconds(30));
+    histogram.observe(std::chrono::seconds(20));
+    auto t = histogram.totals();
+    EXPECT_EQ(t.count, 3u);
+    EXPECT_EQ(t.buckets[0], 1u);
+    EXPECT_EQ(t.buckets[4], 1u);
+    EXPECT_EQ(t.buckets.back(), 1u);
+    EXPECT_EQ(t.sum_us, 20'030'500u);
+}
+
+TEST(MetricsTest, RendersRoutesUpstreamAndCaches) {
+    EXPECT_EQ(match_route("/metrics").resource, Resource::Metrics);
+    EXPECT_EQ(match_route("/metrics").shape, Shape::Index);
+
+    CacheStats stats;
+    ShardedCache<int, std::string> cache(&stats);
+    cache.insert(1, "rick");
+    cache.find(1);
+    cache.find(2);
+    cache.peek(3);
+    EXPECT_EQ(stats.hits.value(), 1u);
+    EXPECT_EQ(stats.misses.value(), 1u);
+
+    CacheStats entity_stats;
+    ShardedCache<int, Character> characters(&entity_stats);
+    Character c;
+    c.id = 1;
+    c.serialized.assign(200, 'x');
+    characters.insert(1, c);
+    characters.insert(1, c);
+    EXPECT_EQ(entity_stats.bytes.value(), entry_bytes(c));
+    EXPECT_GE(entity_stats.bytes.value(), sizeof(Character) + 200);
+
+    ResponseCache responses(8, &stats);
+    responses.put("a", "1234", std::chrono::seconds(60));
+    responses.put("b", "5678", std::chrono::seconds(60));
+    EXPECT_EQ(stats.evictions.value(), 1u);
+
+    metrics().request(match_route("/character/1")).observe(std::chrono::milliseconds(2));
+    metrics().upstream("/api/episode/?page=2").errors.add();
+    auto text = metrics().render();
+    EXPECT_NE(text.find(R"(http_request_duration_seconds_bucket{resource="character",shape="single",le="0.005"} 1)"),
+              std::string::npos);
+    EXPECT_NE(text.find(R"(upstream_errors_total{resource="episode"} 1)"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE cache_hits_total counter"), std::string::npos);
+    EXPECT_NE(text.find(R"(cache_entry_bytes{cache="character"} )"), std::string::npos);
+    EXPECT_NE(text.find("symbol_arena_bytes "), std::string::npos);
+}
+
+TEST(TraceTest, RecordsSpansOnlyWhileEnabled) {
+    { Span span("trace_test_disabled", 7); }
+
+    auto id = next_trace_id();
+    set_tracing(true);
+    {
+        TraceScope scope(id);
+        Span outer("trace_test_outer");
+        std::thread([id]{
+            TraceScope inherited(id);
+            Span inner("trace_test_inner");
+        }).join();
+    }
+    set_tracing(false);
+    EXPECT_EQ(current_trace_id(), 0u);
+
+    auto trace = export_chrome_trace();
+    EXPECT_TRUE(trace.starts_with(R"({"displayTimeUnit":"ms","traceEvents":[)"));
+    EXPECT_EQ(trace.find("trace_test_disabled"), std::string::npos);
+    auto tid = R"(","ph":"X","pid":1,"tid":)" + std::to_string(id) + ",";
+    EXPECT_NE(trace.find("trace_test_outer" + tid), std::string::npos);
+    EXPECT_NE(trace.find("trace_test_inner" + tid), std::string::npos);
+}
+
+TEST(HedgeTest, DelayTracksTailLatency) {
+    using std::chrono::milliseconds;
+    HedgePolicy policy;
+    EXPECT_EQ(policy.delay(), milliseconds(100));
+
+    for (int i = 1; i <= 100; ++i)
+        policy.record(milliseconds(i));
+    EXPECT_GE(policy.delay(), milliseconds(90));
+    EXPECT_LE(policy.delay(), milliseconds(100));
+
+    for (int i = 0; i < 256; ++i)
+        policy.record(std::chrono::microseconds(100));
+    EXPECT_EQ(policy.delay(), milliseconds(5));
+}
+
+TEST(HedgeTest, BudgetCapsHedges) {
+    HedgePolicy policy(0.05);
+    EXPECT_FALSE(policy.try_acquire());
+
+    int hedges = 0;
+    for (int i = 0; i < 100; ++i) {
+        policy.on_request();
+        hedges += policy.try_acquire();
+    }
+    EXPECT_EQ(hedges, 5);
+}
+
 class GlobalTestEnvironment : public ::testing::Environment {
 public:
     void SetUp() override {